@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Allocation tracking
+//-----------------------------
+// Heap allocations attributed to the code that made them. Built with
+// ADAPTIVE_FILTER_ALLOC_TRACKING (CMake option, EKFAdaptiveFilter only),
+// AllocTracker.cpp replaces malloc and its relatives for the whole process
+// and counts each allocation under the tag of the calling thread, set by
+// ADAPTIVE_FILTER_ALLOC_SCOPE for the enclosing block. The counters are
+// relaxed atomics and the tag a thread_local, so nothing in the hooks
+// allocates or locks. Without the option the scopes compile to nothing.
+enum AllocTag : uint8_t {
+    ALLOC_OTHER = 0,
+    ALLOC_STEP = 1,              // filter step outside the stages
+    ALLOC_PREDICTION = 2,
+    ALLOC_IMU = 3,
+    ALLOC_WHEEL = 4,
+    ALLOC_LIDAR = 5,
+    ALLOC_IMU_CALLBACK = 6,      // handlers, by TraceSensor
+    ALLOC_WHEEL_CALLBACK = 7,
+    ALLOC_LIDAR_CALLBACK = 8,
+    ALLOC_OUTPUTS = 9,           // publisher thread
+    N_ALLOC_TAGS = 10
+};
+
+inline const char *alloc_tag_name(uint8_t tag) {
+    static const char *names[N_ALLOC_TAGS] = {"other", "filter step", "prediction", "imu correction", "wheel correction",
+                                              "lidar correction", "imu callback", "wheel callback", "lidar callback", "outputs"};
+    return tag < N_ALLOC_TAGS ? names[tag] : "unknown";
+}
+
+// totals since the start of the process
+struct AllocCounters {
+    uint64_t allocs[N_ALLOC_TAGS];
+    uint64_t bytes[N_ALLOC_TAGS];     // usable size of the blocks
+    uint64_t frees;
+};
+
+#ifdef ADAPTIVE_FILTER_ALLOC_TRACKING
+bool alloc_tracking();
+void alloc_counters(AllocCounters &out);
+
+// tag of the calling thread, returns the previous one
+AllocTag alloc_tag(AllocTag tag);
+
+class AllocScope {
+
+private:
+    AllocTag previous;
+
+public:
+    explicit AllocScope(AllocTag tag) : previous(alloc_tag(tag)) {}
+    ~AllocScope() { alloc_tag(previous); }
+
+    AllocScope(const AllocScope &) = delete;
+    AllocScope &operator=(const AllocScope &) = delete;
+};
+
+#define ADAPTIVE_FILTER_ALLOC_SCOPE(tag) adaptive_filter::AllocScope allocScope(tag)
+#else
+inline bool alloc_tracking() { return false; }
+inline void alloc_counters(AllocCounters &out) { out = AllocCounters(); }
+inline AllocTag alloc_tag(AllocTag) { return ALLOC_OTHER; }
+
+#define ADAPTIVE_FILTER_ALLOC_SCOPE(tag) (void)sizeof(tag)
+#endif
+
+// resident set size and its peak [bytes], without allocating
+inline void memory_usage(size_t &rss, size_t &peak) {
+    rss = peak = 0;
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0){
+        peak = static_cast<size_t>(usage.ru_maxrss)*1024;
+    }
+
+    // second field of statm, in pages
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0){
+        return;
+    }
+    char buffer[128];
+    ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (n <= 0){
+        return;
+    }
+    buffer[n] = '\0';
+    char *end;
+    std::strtoull(buffer, &end, 10);
+    rss = static_cast<size_t>(std::strtoull(end, nullptr, 10))*static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+}  // namespace adaptive_filter
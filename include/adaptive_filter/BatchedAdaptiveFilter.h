@@ -0,0 +1,461 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cmath>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Batched filter bank
+//-----------------------------
+// N independent copies of the AdaptiveFilter EKF stored as structure of
+// arrays: column k of X holds state k of every instance and column i*12+j
+// of P holds P(i,j) of every instance. The models are written as column-wise
+// array expressions, so Eigen vectorises every operation across instances
+// (2/4/8 filters per SIMD register depending on the target).
+class BatchedAdaptiveFilter {
+
+public:
+    typedef Eigen::ArrayXd Lanes;
+    typedef Eigen::Array<bool, Eigen::Dynamic, 1> LaneMask;
+
+    // number of state or measure vectors
+    static const int N_STATES = 12;
+    static const int N_IMU = 3;
+    static const int N_WHEEL = 2;
+    static const int N_LIDAR = 6;
+
+private:
+    int n;
+
+    // states and covariances (SoA)
+    Eigen::ArrayXXd X, P;
+
+    // staged measurements and covariances
+    Eigen::ArrayXXd imuMeasure, E_imu;
+    Eigen::ArrayXXd wheelMeasure, E_wheel;
+    Eigen::ArrayXXd lidarMeasure, lidarMeasureL, E_lidar, E_lidarL;
+    LaneMask imuNew, wheelNew, lidarNew, lidarActivated, lidarMask;
+
+    // fixed prediction covariance (diagonal, shared by all instances)
+    Eigen::Matrix<double, N_STATES, 1> E_pred;
+
+    // preallocated work buffers
+    Eigen::ArrayXXd trig, xp, f0, f1, x_plus, F, FP;
+    Eigen::ArrayXXd HP, S, L, Z, Y, E, innov;
+    Eigen::ArrayXXd G, Gl, u_plus, dang;
+
+    // covariance gains
+    double lidarG, wheelG, imuG;
+
+    // adaptive covariance constants
+    double nCorner, nSurf;
+    double Gx, Gy, Gz, Gphi, Gtheta, Gpsi;
+    double l_min;
+
+public:
+    BatchedAdaptiveFilter(int n_filters, double lidar_gain, double wheel_gain, double imu_gain)
+        : n(n_filters), lidarG(lidar_gain), wheelG(wheel_gain), imuG(imu_gain) {
+        allocateMemory();
+        for (int lane = 0; lane < n; lane++){
+            initialization(lane);
+        }
+
+        // Fixed prediction covariance
+        E_pred.setZero();
+        E_pred.tail(6).setConstant(0.01*0.1);
+
+        // adptive covariance constants (same as AdaptiveFilter)
+        nCorner = 500.0;
+        nSurf = 5000;
+
+        Gz = 0.0048;
+        Gx = 0.0022;
+        Gy = 0.0016;
+        Gpsi = 0.0044;
+        Gphi = 0.0052;
+        Gtheta = 0.005;
+
+        l_min = 0.005;
+    }
+
+    int size() const { return n; }
+
+    //------------------
+    // Auxliar functions
+    //------------------
+    void allocateMemory() {
+        X.resize(n, N_STATES);
+        P.resize(n, N_STATES*N_STATES);
+
+        imuMeasure.resize(n, N_IMU);
+        E_imu.resize(n, N_IMU*N_IMU);
+        wheelMeasure.resize(n, N_WHEEL);
+        E_wheel.resize(n, N_WHEEL*N_WHEEL);
+        lidarMeasure.resize(n, N_LIDAR);
+        lidarMeasureL.resize(n, N_LIDAR);
+        E_lidar.resize(n, N_LIDAR);
+        E_lidarL.resize(n, N_LIDAR);
+
+        imuNew.resize(n);
+        wheelNew.resize(n);
+        lidarNew.resize(n);
+        lidarActivated.resize(n);
+        lidarMask.resize(n);
+
+        trig.resize(n, 6);
+        xp.resize(n, N_STATES);
+        f0.resize(n, N_STATES);
+        f1.resize(n, N_STATES);
+        x_plus.resize(n, N_STATES);
+        F.resize(n, N_STATES*N_STATES);
+        FP.resize(n, N_STATES*N_STATES);
+
+        HP.resize(n, N_LIDAR*N_STATES);
+        S.resize(n, N_LIDAR*N_LIDAR);
+        L.resize(n, N_LIDAR*N_LIDAR);
+        Z.resize(n, N_LIDAR*N_STATES);
+        Y.resize(n, N_LIDAR);
+        E.resize(n, N_LIDAR*N_LIDAR);
+        innov.resize(n, N_LIDAR);
+
+        G.resize(n, N_LIDAR*N_LIDAR);
+        Gl.resize(n, N_LIDAR*N_LIDAR);
+        u_plus.resize(n, N_LIDAR);
+        dang.resize(n, 3);
+    }
+
+    // state and covariance of one instance back to the initial values
+    void initialization(int lane) {
+        X.row(lane).setZero();
+        P.row(lane).setZero();
+        for (int i = 0; i < N_STATES; i++){
+            P(lane, i*N_STATES + i) = 0.1;
+        }
+
+        imuMeasure.row(lane).setZero();
+        E_imu.row(lane).setZero();
+        wheelMeasure.row(lane).setZero();
+        E_wheel.row(lane).setZero();
+        lidarMeasure.row(lane).setZero();
+        lidarMeasureL.row(lane).setZero();
+        E_lidar.row(lane).setZero();
+        E_lidarL.row(lane).setZero();
+
+        imuNew(lane) = false;
+        wheelNew(lane) = false;
+        lidarNew(lane) = false;
+        lidarActivated(lane) = false;
+    }
+
+    double state(int lane, int i) const { return X(lane, i); }
+    double covariance(int lane, int i, int j) const { return P(lane, i*N_STATES + j); }
+
+    //--------------------
+    // measurement staging
+    //--------------------
+    void set_imu(int lane, double roll, double pitch, double yaw, const double *orientation_covariance) {
+        imuMeasure.row(lane) << roll, pitch, yaw;
+        for (int k = 0; k < N_IMU*N_IMU; k++){
+            E_imu(lane, k) = imuG*orientation_covariance[k];
+        }
+        imuNew(lane) = true;
+    }
+
+    void set_wheel(int lane, double v, double w, double cov_v, double cov_w) {
+        wheelMeasure.row(lane) << v, w;
+        E_wheel.row(lane) << wheelG*cov_v, 0.0, 0.0, 100*cov_w;
+        wheelNew(lane) = true;
+    }
+
+    void set_lidar(int lane, const double *pose, double fCorner, double fSurf) {
+        for (int k = 0; k < N_LIDAR; k++){
+            lidarMeasure(lane, k) = pose[k];
+        }
+
+        // heuristic (see AdaptiveFilter::adaptive_covariance)
+        double cov_corner = (nCorner - std::min(fCorner,nCorner))/nCorner + l_min;
+        double cov_surf = (nSurf - std::min(fSurf,nSurf))/nSurf + l_min;
+        E_lidar.row(lane) << lidarG*Gx*cov_corner, lidarG*Gy*cov_corner, lidarG*Gz*cov_surf,
+                             lidarG*Gphi*cov_surf, lidarG*Gtheta*cov_surf, lidarG*Gpsi*cov_corner;
+
+        lidarNew(lane) = true;
+    }
+
+    bool imu_pending(int lane) const { return imuNew(lane); }
+    bool wheel_pending(int lane) const { return wheelNew(lane); }
+    bool lidar_pending(int lane) const { return lidarNew(lane); }
+
+    //-----------------
+    // predict function
+    //-----------------
+    void prediction_stage(const Lanes &dt) {
+        // jacobian's computation
+        jacobian_state(dt);
+
+        // Priori state
+        f_prediction_model(X, dt, xp);
+        X = xp;
+
+        // Priori covariance: P = F*P*F' + E_pred
+        for (int r = 0; r < N_STATES; r++){
+            for (int c = 0; c < N_STATES; c++){
+                FP.col(r*N_STATES + c) = F.col(r*N_STATES)*P.col(c);
+                for (int k = 1; k < N_STATES; k++){
+                    FP.col(r*N_STATES + c) += F.col(r*N_STATES + k)*P.col(k*N_STATES + c);
+                }
+            }
+        }
+        for (int r = 0; r < N_STATES; r++){
+            for (int c = 0; c < N_STATES; c++){
+                P.col(r*N_STATES + c) = FP.col(r*N_STATES)*F.col(c*N_STATES);
+                for (int k = 1; k < N_STATES; k++){
+                    P.col(r*N_STATES + c) += FP.col(r*N_STATES + k)*F.col(c*N_STATES + k);
+                }
+            }
+            P.col(r*N_STATES + r) += E_pred(r);
+        }
+    }
+
+    //-----------------
+    // correction stage
+    //-----------------
+    void correction_imu_stage() {
+        static const int idx[N_IMU] = {3, 4, 5};
+        if (!imuNew.any()) return;
+
+        Y.leftCols(N_IMU) = imuMeasure;
+        E.leftCols(N_IMU*N_IMU) = E_imu;
+        correction(idx, N_IMU, imuNew);
+
+        imuNew.setConstant(false);
+    }
+
+    void correction_wheel_stage() {
+        static const int idx[N_WHEEL] = {6, 11};
+        if (!wheelNew.any()) return;
+
+        Y.leftCols(N_WHEEL) = wheelMeasure;
+        E.leftCols(N_WHEEL*N_WHEEL) = E_wheel;
+        correction(idx, N_WHEEL, wheelNew);
+
+        wheelNew.setConstant(false);
+    }
+
+    void correction_lidar_stage(const Lanes &dt) {
+        static const int idx[N_LIDAR] = {6, 7, 8, 9, 10, 11};
+        if (!lidarNew.any()) return;
+
+        // indirect measurement and its error propagation
+        indirect_lidar_measurement(lidarMeasure, lidarMeasureL, dt, Y);
+        jacobian_lidar_measurement(dt);
+
+        for (int a = 0; a < N_LIDAR; a++){
+            for (int b = 0; b < N_LIDAR; b++){
+                E.col(a*N_LIDAR + b) = G.col(a*N_LIDAR)*G.col(b*N_LIDAR)*E_lidar.col(0)
+                                     + Gl.col(a*N_LIDAR)*Gl.col(b*N_LIDAR)*E_lidarL.col(0);
+                for (int k = 1; k < N_LIDAR; k++){
+                    E.col(a*N_LIDAR + b) += G.col(a*N_LIDAR + k)*G.col(b*N_LIDAR + k)*E_lidar.col(k)
+                                          + Gl.col(a*N_LIDAR + k)*Gl.col(b*N_LIDAR + k)*E_lidarL.col(k);
+                }
+            }
+        }
+
+        // the first LiDAR measurement of an instance only primes lidarMeasureL
+        lidarMask = lidarNew && lidarActivated;
+        correction(idx, N_LIDAR, lidarMask);
+
+        // last measurement
+        for (int k = 0; k < N_LIDAR; k++){
+            lidarMeasureL.col(k) = lidarNew.select(lidarMeasure.col(k), lidarMeasureL.col(k));
+            E_lidarL.col(k) = lidarNew.select(E_lidar.col(k), E_lidarL.col(k));
+        }
+        lidarActivated = lidarActivated || lidarNew;
+        lidarNew.setConstant(false);
+    }
+
+private:
+    // Kalman update for a measurement that observes the states idx[0..m)
+    // directly (H is a selection), using Y and E staged in the work buffers.
+    // Lanes outside mask keep their state and covariance.
+    void correction(const int *idx, int m, const LaneMask &mask) {
+        // H*P and S = H*P*H' + E
+        for (int a = 0; a < m; a++){
+            for (int c = 0; c < N_STATES; c++){
+                HP.col(a*N_STATES + c) = P.col(idx[a]*N_STATES + c);
+            }
+            for (int b = 0; b < m; b++){
+                S.col(a*m + b) = HP.col(a*N_STATES + idx[b]) + E.col(a*m + b);
+            }
+            innov.col(a) = Y.col(a) - X.col(idx[a]);
+        }
+
+        // S = L*L' (Cholesky, lane-wise)
+        for (int j = 0; j < m; j++){
+            L.col(j*m + j) = S.col(j*m + j);
+            for (int k = 0; k < j; k++){
+                L.col(j*m + j) -= L.col(j*m + k).square();
+            }
+            L.col(j*m + j) = L.col(j*m + j).sqrt();
+            for (int i = j + 1; i < m; i++){
+                L.col(i*m + j) = S.col(i*m + j);
+                for (int k = 0; k < j; k++){
+                    L.col(i*m + j) -= L.col(i*m + k)*L.col(j*m + k);
+                }
+                L.col(i*m + j) /= L.col(j*m + j);
+            }
+        }
+
+        // Z = S^-1*H*P, so that K = P*H'*S^-1 = Z'
+        for (int c = 0; c < N_STATES; c++){
+            for (int a = 0; a < m; a++){
+                Z.col(a*N_STATES + c) = HP.col(a*N_STATES + c);
+                for (int k = 0; k < a; k++){
+                    Z.col(a*N_STATES + c) -= L.col(a*m + k)*Z.col(k*N_STATES + c);
+                }
+                Z.col(a*N_STATES + c) /= L.col(a*m + a);
+            }
+            for (int a = m - 1; a >= 0; a--){
+                for (int k = a + 1; k < m; k++){
+                    Z.col(a*N_STATES + c) -= L.col(k*m + a)*Z.col(k*N_STATES + c);
+                }
+                Z.col(a*N_STATES + c) /= L.col(a*m + a);
+            }
+        }
+
+        // lanes without a new measurement get a zero gain
+        for (int a = 0; a < m; a++){
+            innov.col(a) = mask.select(innov.col(a), 0.0);
+            for (int c = 0; c < N_STATES; c++){
+                Z.col(a*N_STATES + c) = mask.select(Z.col(a*N_STATES + c), 0.0);
+            }
+        }
+
+        // correction: X = X + K*(Y - hx), P = P - K*H*P
+        for (int r = 0; r < N_STATES; r++){
+            for (int a = 0; a < m; a++){
+                X.col(r) += Z.col(a*N_STATES + r)*innov.col(a);
+            }
+            for (int c = 0; c < N_STATES; c++){
+                for (int a = 0; a < m; a++){
+                    P.col(r*N_STATES + c) -= Z.col(a*N_STATES + r)*HP.col(a*N_STATES + c);
+                }
+            }
+        }
+    }
+
+    //---------
+    // Models
+    //---------
+    template <typename In, typename Out>
+    void f_prediction_model(const In &x, const Lanes &dt, Out &out) {
+        // state: {x, y, z, roll, pitch, yaw, vx, vy, vz, wx, wy, wz}
+        //        {         (world)         }{        (body)        }
+        trig.col(0) = x.col(3).cos();
+        trig.col(1) = x.col(3).sin();
+        trig.col(2) = x.col(4).cos();
+        trig.col(3) = x.col(4).sin();
+        trig.col(4) = x.col(5).cos();
+        trig.col(5) = x.col(5).sin();
+
+        const auto cr = trig.col(0), sr = trig.col(1);
+        const auto cp = trig.col(2), sp = trig.col(3);
+        const auto cy = trig.col(4), sy = trig.col(5);
+        const auto vx = x.col(6), vy = x.col(7), vz = x.col(8);
+        const auto wx = x.col(9), wy = x.col(10), wz = x.col(11);
+
+        // R = Rz*Ry*Rx
+        out.col(0) = x.col(0) + (cy*cp*vx + (cy*sp*sr - sy*cr)*vy + (cy*sp*cr + sy*sr)*vz)*dt;
+        out.col(1) = x.col(1) + (sy*cp*vx + (sy*sp*sr + cy*cr)*vy + (sy*sp*cr - cy*sr)*vz)*dt;
+        out.col(2) = x.col(2) + (-sp*vx + cp*sr*vy + cp*cr*vz)*dt;
+
+        // Euler angle rates
+        out.col(3) = x.col(3) + (wx + sr*sp/cp*wy + cr*sp/cp*wz)*dt;
+        out.col(4) = x.col(4) + (cr*wy - sr*wz)*dt;
+        out.col(5) = x.col(5) + (sr/cp*wy + cr/cp*wz)*dt;
+
+        out.rightCols(6) = x.rightCols(6);
+    }
+
+    template <typename In>
+    void indirect_lidar_measurement(const In &u, const In &ul, const Lanes &dt, Eigen::ArrayXXd &up) {
+        trig.col(0) = ul.col(3).cos();
+        trig.col(1) = ul.col(3).sin();
+        trig.col(2) = ul.col(4).cos();
+        trig.col(3) = ul.col(4).sin();
+        trig.col(4) = ul.col(5).cos();
+        trig.col(5) = ul.col(5).sin();
+
+        const auto cr = trig.col(0), sr = trig.col(1);
+        const auto cp = trig.col(2), sp = trig.col(3);
+        const auto cy = trig.col(4), sy = trig.col(5);
+
+        // angle differences wrapped to [-pi, pi)
+        for (int k = 0; k < 3; k++){
+            dang.col(k) = u.col(3 + k) - ul.col(3 + k);
+            dang.col(k) -= 2*M_PI*((dang.col(k) + M_PI)/(2*M_PI)).floor();
+        }
+        const auto dphi = dang.col(0), dtheta = dang.col(1), dpsi = dang.col(2);
+
+        // R'*(p - pl)/dt
+        up.col(0) = (cy*cp*(u.col(0) - ul.col(0)) + sy*cp*(u.col(1) - ul.col(1)) - sp*(u.col(2) - ul.col(2)))/dt;
+        up.col(1) = ((cy*sp*sr - sy*cr)*(u.col(0) - ul.col(0)) + (sy*sp*sr + cy*cr)*(u.col(1) - ul.col(1))
+                    + cp*sr*(u.col(2) - ul.col(2)))/dt;
+        up.col(2) = ((cy*sp*cr + sy*sr)*(u.col(0) - ul.col(0)) + (sy*sp*cr - cy*sr)*(u.col(1) - ul.col(1))
+                    + cp*cr*(u.col(2) - ul.col(2)))/dt;
+
+        // J^-1*(a - al)/dt
+        up.col(3) = (dphi - sp*dpsi)/dt;
+        up.col(4) = (cr*dtheta + sr*cp*dpsi)/dt;
+        up.col(5) = (-sr*dtheta + cr*cp*dpsi)/dt;
+    }
+
+    //----------
+    // Jacobians
+    //----------
+    void jacobian_state(const Lanes &dt) {
+        f_prediction_model(X, dt, f0);
+
+        double delta = 0.0001;
+        for (int i = 0; i < N_STATES; i++){
+            x_plus = X;
+            x_plus.col(i) += delta;
+
+            f_prediction_model(x_plus, dt, f1);
+
+            for (int r = 0; r < N_STATES; r++){
+                F.col(r*N_STATES + i) = (f1.col(r) - f0.col(r))/delta;
+            }
+            for (int r = 3; r < 6; r++){
+                F.col(r*N_STATES + i) = (f1.col(r) - f0.col(r)).sin()/delta;
+            }
+        }
+    }
+
+    // G = dY/du and Gl = dY/dul around the staged measurement Y
+    void jacobian_lidar_measurement(const Lanes &dt) {
+        double delta = 0.0000001;
+        for (int i = 0; i < N_LIDAR; i++){
+            u_plus = lidarMeasure;
+            u_plus.col(i) += delta;
+            indirect_lidar_measurement(u_plus, lidarMeasureL, dt, f1);
+            jacobian_column(G, i, delta);
+
+            u_plus = lidarMeasureL;
+            u_plus.col(i) += delta;
+            indirect_lidar_measurement(lidarMeasure, u_plus, dt, f1);
+            jacobian_column(Gl, i, delta);
+        }
+    }
+
+    void jacobian_column(Eigen::ArrayXXd &J, int i, double delta) {
+        for (int r = 0; r < 3; r++){
+            J.col(r*N_LIDAR + i) = (f1.col(r) - Y.col(r))/delta;
+        }
+        for (int r = 3; r < N_LIDAR; r++){
+            J.col(r*N_LIDAR + i) = (f1.col(r) - Y.col(r)).sin()/delta;
+        }
+    }
+};
+
+}  // namespace adaptive_filter
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Measurement records
+//-----------------------------
+// The fields of sensor_msgs/Imu and nav_msgs/Odometry that the filter uses.
+struct ImuMeasurement {
+    double stamp;                              // [s]
+    double orientation[4];                     // x, y, z, w
+    double orientationCovariance[9];
+    double angularVelocity[3];
+    double angularVelocityCovariance[9];
+    double linearAcceleration[3];
+    double linearAccelerationCovariance[9];
+};
+
+struct OdometryMeasurement {
+    double stamp;                              // [s]
+    double position[3];
+    double orientation[4];                     // x, y, z, w
+    double linear[3];
+    double angular[3];
+    double twistCovariance[36];
+};
+
+//-----------------------------
+// CDR reader
+//-----------------------------
+// Forward-only reader over a serialized ROS 2 message (XCDR1, as written by
+// the default RMW implementations): a 4-byte encapsulation header followed by
+// the fields, each aligned to its own size relative to the end of the header.
+// Reads past the end of the buffer return zero and clear good().
+class CdrReader {
+
+private:
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    bool swap;
+    bool ok;
+
+    bool reserve(size_t n) {
+        if (!ok || n > size - pos){
+            ok = false;
+            return false;
+        }
+        return true;
+    }
+
+    static void swap_bytes(uint8_t *p, size_t n) {
+        for (size_t i = 0; i < n/2; i++){
+            uint8_t t = p[i];
+            p[i] = p[n - 1 - i];
+            p[n - 1 - i] = t;
+        }
+    }
+
+public:
+    CdrReader(const uint8_t *buffer, size_t length) : data(buffer + 4), size(length - 4), pos(0), swap(false), ok(true) {
+        if (length < 4){
+            data = buffer;
+            size = 0;
+            ok = false;
+            return;
+        }
+        // encapsulation kind: only plain CDR (CDR_BE 0x0000, CDR_LE 0x0001),
+        // parameter lists and XCDR2 are not laid out like the message
+        if (buffer[0] != 0x00 || buffer[1] > 0x01){
+            size = 0;
+            ok = false;
+            return;
+        }
+        bool little = buffer[1] == 0x01;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        swap = little;
+#else
+        swap = !little;
+#endif
+    }
+
+    bool good() const { return ok; }
+
+    void align(size_t n) {
+        pos = (pos + n - 1) & ~(n - 1);
+        if (pos > size){
+            pos = size;
+            ok = false;
+        }
+    }
+
+    void skip(size_t n) {
+        if (reserve(n)){
+            pos += n;
+        }
+    }
+
+    template <typename T>
+    T read() {
+        T value = 0;
+        align(sizeof(T));
+        if (!reserve(sizeof(T))){
+            return value;
+        }
+        std::memcpy(&value, data + pos, sizeof(T));
+        if (swap){
+            swap_bytes(reinterpret_cast<uint8_t*>(&value), sizeof(T));
+        }
+        pos += sizeof(T);
+        return value;
+    }
+
+    void read(double *out, size_t n) {
+        align(8);
+        if (!reserve(8*n)){
+            return;
+        }
+        std::memcpy(out, data + pos, 8*n);
+        if (swap){
+            for (size_t i = 0; i < n; i++){
+                swap_bytes(reinterpret_cast<uint8_t*>(out + i), 8);
+            }
+        }
+        pos += 8*n;
+    }
+
+    void skip_doubles(size_t n) {
+        align(8);
+        skip(8*n);
+    }
+
+    // length (including the terminating null) followed by the characters
+    void skip_string() {
+        uint32_t length = read<uint32_t>();
+        skip(length);
+    }
+
+    // std_msgs/Header: stamp, frame_id
+    double read_header_stamp() {
+        int32_t sec = read<int32_t>();
+        uint32_t nanosec = read<uint32_t>();
+        skip_string();
+        return sec + nanosec * 1e-9;
+    }
+};
+
+//-----------------------------
+// Field-selective parsers
+//-----------------------------
+// false when the buffer is shorter than the message
+inline bool parse_imu(const uint8_t *buffer, size_t length, ImuMeasurement &out) {
+    CdrReader cdr(buffer, length);
+    out.stamp = cdr.read_header_stamp();
+    cdr.read(out.orientation, 4);
+    cdr.read(out.orientationCovariance, 9);
+    cdr.read(out.angularVelocity, 3);
+    cdr.read(out.angularVelocityCovariance, 9);
+    cdr.read(out.linearAcceleration, 3);
+    cdr.read(out.linearAccelerationCovariance, 9);
+    return cdr.good();
+}
+
+// the pose covariance is skipped
+inline bool parse_odometry(const uint8_t *buffer, size_t length, OdometryMeasurement &out) {
+    CdrReader cdr(buffer, length);
+    out.stamp = cdr.read_header_stamp();
+    cdr.skip_string();   // child_frame_id
+    cdr.read(out.position, 3);
+    cdr.read(out.orientation, 4);
+    cdr.skip_doubles(36);
+    cdr.read(out.linear, 3);
+    cdr.read(out.angular, 3);
+    cdr.read(out.twistCovariance, 36);
+    return cdr.good();
+}
+
+}  // namespace adaptive_filter
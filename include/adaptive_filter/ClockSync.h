@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <algorithm>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Clock synchronization
+//-----------------------------
+// Offset and drift of a sensor clock with respect to the host clock, from
+// the (header stamp, arrival time) pairs of its messages. arrival - stamp is
+// the clock offset plus a transport delay that is never negative, so the
+// minimum over each window is taken as a measurement of the offset and
+// tracked by a two-state Kalman filter (offset, drift) with the drift as a
+// random walk. The estimated offset therefore includes the minimum transport
+// delay: corrected stamps are the earliest possible arrival times.
+class ClockSync {
+
+private:
+    double window;        // [s] of sensor time per offset measurement
+    double noise;         // [s] standard deviation of the window minimum
+    double driftNoise;    // [1/sqrt(s)] random walk of the drift
+
+    // window minimum
+    bool windowOpen;
+    double windowStart;
+    double windowMin;
+    double windowMinStamp;
+
+    // offset at stamp0 and drift
+    bool ready;
+    double stamp0;
+    double stampLast;
+    Eigen::Vector2d x;
+    Eigen::Matrix2d P;
+
+public:
+    explicit ClockSync(double window_length = 1.0, double offset_noise = 1e-3, double drift_noise = 1e-6)
+        : window(window_length), noise(offset_noise), driftNoise(drift_noise) {
+        reset();
+    }
+
+    void reset() {
+        windowOpen = false;
+        ready = false;
+        stamp0 = 0;
+        stampLast = 0;
+        x.setZero();
+        P.setZero();
+    }
+
+    // stamp: sensor clock, arrival: host clock [s]
+    void sample(double stamp, double arrival) {
+        double offset = arrival - stamp;
+        stampLast = stamp;
+
+        if (!windowOpen){
+            windowOpen = true;
+            windowStart = stamp;
+            windowMin = offset;
+            windowMinStamp = stamp;
+        } else if (offset < windowMin){
+            windowMin = offset;
+            windowMinStamp = stamp;
+        }
+
+        // until the first window closes, the running minimum is the estimate
+        if (!ready){
+            x << windowMin, 0;
+            stamp0 = windowMinStamp;
+        }
+
+        if (stamp - windowStart < window){
+            return;
+        }
+        windowOpen = false;
+
+        if (!ready){
+            ready = true;
+            P << noise*noise, 0,
+                 0, 1e-8;   // 100 ppm
+            return;
+        }
+
+        // prediction to the stamp of the window minimum
+        double dt = windowMinStamp - stamp0;
+        Eigen::Matrix2d F;
+        F << 1, dt,
+             0, 1;
+        Eigen::Matrix2d Q;
+        Q << dt*dt*dt/3, dt*dt/2,
+             dt*dt/2, dt;
+        x = F*x;
+        P = F*P*F.transpose() + driftNoise*driftNoise*Q.cwiseAbs();
+        stamp0 = windowMinStamp;
+
+        // correction with the window minimum
+        double S = P(0,0) + noise*noise;
+        Eigen::Vector2d K = P.col(0)/S;
+        x += K*(windowMin - x(0));
+        P -= K*P.row(0);
+    }
+
+    bool synchronized() const { return ready; }
+
+    // sensor-to-host offset [s] at a sensor stamp
+    double offset(double stamp) const { return x(0) + x(1)*(stamp - stamp0); }
+
+    // offset at the newest sample
+    double offset() const { return offset(stampLast); }
+
+    // drift [s/s]
+    double drift() const { return x(1); }
+
+    // sensor stamp in host time
+    double to_host(double stamp) const { return stamp + offset(stamp); }
+};
+
+}  // namespace adaptive_filter
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Chi-square distribution
+//-----------------------------
+// P(k/2, x/2), the regularized lower incomplete gamma function, by its
+// series below a + 1 and its continued fraction above
+inline double chi2_cdf(double x, double k) {
+    if (x <= 0){
+        return 0;
+    }
+    double a = 0.5*k;
+    double z = 0.5*x;
+    double front = std::exp(a*std::log(z) - z - std::lgamma(a));
+
+    if (z < a + 1){
+        double term = 1.0/a;
+        double sum = term;
+        for (int n = 1; n < 500 && term > sum*1e-15; n++){
+            term *= z/(a + n);
+            sum += term;
+        }
+        return std::min(1.0, front*sum);
+    }
+
+    // Lentz
+    double b = z + 1 - a;
+    double c = 1e300;
+    double d = 1.0/b;
+    double h = d;
+    for (int n = 1; n < 500; n++){
+        double an = -n*(n - a);
+        b += 2;
+        d = an*d + b;
+        d = std::fabs(d) < 1e-300 ? 1e-300 : d;
+        c = b + an/c;
+        c = std::fabs(c) < 1e-300 ? 1e-300 : c;
+        d = 1.0/d;
+        double delta = d*c;
+        h *= delta;
+        if (std::fabs(delta - 1) < 1e-15){
+            break;
+        }
+    }
+    return std::max(0.0, 1.0 - front*h);
+}
+
+// x with chi2_cdf(x, k) = p, by bisection
+inline double chi2_quantile(double p, double k) {
+    double lo = 0;
+    double hi = k + 20*std::sqrt(2*k) + 20;
+    for (int i = 0; i < 100; i++){
+        double mid = 0.5*(lo + hi);
+        if (chi2_cdf(mid, k) < p){
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0.5*(lo + hi);
+}
+
+//-----------------------------
+// NIS monitor
+//-----------------------------
+// Consistency of the corrections of one sensor from their normalized
+// innovation squared r' S^-1 r, chi-square with dof degrees of freedom when
+// the filter is consistent. O(1) per sample and without allocation; the
+// window accumulators are read and restarted by summarize(). Each sample is
+// checked against the two-sided per-sample bounds at the confidence level,
+// the window mean against the bounds of the mean of its samples (window_bounds,
+// for the reporting side: it inverts the distribution).
+struct NisSummary {
+    uint32_t samples;
+    double mean;
+    double max;
+    uint32_t outside;        // samples outside the per-sample bounds
+    uint64_t totalSamples;
+    int dof;
+    double confidence;
+    double lower, upper;     // per-sample bounds
+};
+
+class NisMonitor {
+
+private:
+    int dof;
+    double confidence;
+    double lower, upper;     // per-sample bounds
+
+    uint32_t count;
+    double sum, max;
+    uint32_t outside;
+    uint64_t totalSamples;
+
+public:
+    explicit NisMonitor(int degrees = 1, double confidence_level = 0.95) {
+        configure(degrees, confidence_level);
+        reset();
+    }
+
+    void configure(int degrees, double confidence_level) {
+        dof = std::max(degrees, 1);
+        confidence = std::min(std::max(confidence_level, 0.5), 0.9999);
+        lower = chi2_quantile(0.5*(1 - confidence), dof);
+        upper = chi2_quantile(0.5*(1 + confidence), dof);
+    }
+
+    void reset() {
+        totalSamples = 0;
+        restart();
+    }
+
+    void restart() {
+        count = 0;
+        sum = max = 0;
+        outside = 0;
+    }
+
+    void sample(double nis) {
+        count++;
+        totalSamples++;
+        sum += nis;
+        max = std::max(max, nis);
+        if (nis < lower || nis > upper){
+            outside++;
+        }
+    }
+
+    // statistics of the window that ends now, then starts the next one
+    void summarize(NisSummary &out) {
+        out.samples = count;
+        out.mean = count > 0 ? sum/count : 0;
+        out.max = max;
+        out.outside = outside;
+        out.totalSamples = totalSamples;
+        out.dof = dof;
+        out.confidence = confidence;
+        out.lower = lower;
+        out.upper = upper;
+        restart();
+    }
+};
+
+// bounds of the mean NIS of a window: n times it is chi-square with n dof
+// degrees of freedom
+inline void window_bounds(const NisSummary &s, double &lower, double &upper) {
+    if (s.samples == 0){
+        lower = upper = 0;
+        return;
+    }
+    double k = static_cast<double>(s.samples)*s.dof;
+    lower = chi2_quantile(0.5*(1 - s.confidence), k)/s.samples;
+    upper = chi2_quantile(0.5*(1 + s.confidence), k)/s.samples;
+}
+
+}  // namespace adaptive_filter
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Deadline monitor
+//-----------------------------
+// Deadline accounting of a periodic step split in stages. mark() charges the
+// time since the previous mark (or the step start) to a stage, end() checks
+// the step against the deadline counted from its scheduled release, so the
+// start lateness is part of it, and blames an overrun on the stage that took
+// longest in that step. O(1) per mark and without allocation; the
+// window maxima are read and restarted by summarize(), the totals run from
+// reset().
+enum StepStage : uint8_t { STAGE_PREDICTION = 0, STAGE_IMU = 1, STAGE_WHEEL = 2, STAGE_LIDAR = 3, STAGE_PUBLISH = 4, N_STAGES = 5 };
+
+inline const char *stage_name(uint8_t stage) {
+    static const char *names[N_STAGES] = {"prediction", "imu correction", "wheel correction", "lidar correction", "publishing"};
+    return stage < N_STAGES ? names[stage] : "unknown";
+}
+
+struct StepOverrun {
+    uint64_t step;
+    double duration;               // [s] from the release, lateness included
+    double lateness;               // [s] of the start after the release
+    double overrun;                // [s] past the deadline
+    uint8_t stage;                 // longest stage of the step
+    double stages[N_STAGES];       // [s]
+};
+
+struct DeadlineSummary {
+    uint64_t steps;
+    uint64_t overruns;
+    double durationMax;            // [s] over the window
+    double stageMax[N_STAGES];     // [s] over the window
+    uint64_t stageOverruns[N_STAGES];
+    double longestOverrun;         // [s] since reset
+    uint8_t longestStage;
+};
+
+class DeadlineMonitor {
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    double deadline;     // [s]
+
+    Clock::time_point release;
+    Clock::time_point last;
+    double stages[N_STAGES];
+    double lateness;
+    double duration;
+
+    double durationMax;
+    double stageMax[N_STAGES];
+
+    uint64_t steps;
+    uint64_t overruns;
+    uint64_t stageOverruns[N_STAGES];
+    double longestOverrun;
+    uint8_t longestStage;
+
+public:
+    explicit DeadlineMonitor(double step_deadline = 0.005) : deadline(step_deadline) {
+        begin();
+        reset();
+    }
+
+    void configure(double step_deadline) {
+        deadline = step_deadline;
+    }
+
+    void reset() {
+        steps = overruns = 0;
+        std::fill(stageOverruns, stageOverruns + N_STAGES, 0);
+        longestOverrun = 0;
+        longestStage = STAGE_PREDICTION;
+        durationMax = 0;
+        std::fill(stageMax, stageMax + N_STAGES, 0.0);
+    }
+
+    // step started at now, scheduled at release_time
+    void begin(Clock::time_point now, Clock::time_point release_time) {
+        release = std::min(release_time, now);
+        last = now;
+        std::fill(stages, stages + N_STAGES, 0.0);
+        lateness = std::chrono::duration<double>(now - release).count();
+        duration = 0;
+    }
+
+    void begin(Clock::time_point now) { begin(now, now); }
+
+    void begin() { begin(Clock::now()); }
+
+    void mark(StepStage stage) {
+        Clock::time_point now = Clock::now();
+        stages[stage] += std::chrono::duration<double>(now - last).count();
+        last = now;
+    }
+
+    // true when the step missed its deadline, out then describes it
+    bool end(StepOverrun &out) {
+        duration = std::chrono::duration<double>(Clock::now() - release).count();
+        steps++;
+        durationMax = std::max(durationMax, duration);
+
+        uint8_t longest = 0;
+        for (int i = 0; i < N_STAGES; i++){
+            stageMax[i] = std::max(stageMax[i], stages[i]);
+            if (stages[i] > stages[longest]){
+                longest = i;
+            }
+        }
+
+        if (duration <= deadline){
+            return false;
+        }
+
+        double overrun = duration - deadline;
+        overruns++;
+        stageOverruns[longest]++;
+        if (overrun > longestOverrun){
+            longestOverrun = overrun;
+            longestStage = longest;
+        }
+
+        out.step = steps;
+        out.duration = duration;
+        out.lateness = lateness;
+        out.overrun = overrun;
+        out.stage = longest;
+        std::copy(stages, stages + N_STAGES, out.stages);
+        return true;
+    }
+
+    double step_deadline() const { return deadline; }
+
+    // of the step, valid after end() [s]
+    double step_duration() const { return duration; }
+    double step_lateness() const { return lateness; }
+    double stage_time(int stage) const { return stages[stage]; }
+
+    // statistics of the window that ends now, then starts the next one
+    void summarize(DeadlineSummary &out) {
+        out.steps = steps;
+        out.overruns = overruns;
+        out.durationMax = durationMax;
+        std::copy(stageMax, stageMax + N_STAGES, out.stageMax);
+        std::copy(stageOverruns, stageOverruns + N_STAGES, out.stageOverruns);
+        out.longestOverrun = longestOverrun;
+        out.longestStage = longestStage;
+
+        durationMax = 0;
+        std::fill(stageMax, stageMax + N_STAGES, 0.0);
+    }
+};
+
+}  // namespace adaptive_filter
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Metrics registry
+//-----------------------------
+// Counters, gauges and histograms for a Prometheus scrape. Series are
+// registered up front (before any update and before the server starts);
+// updates are wait-free: each thread adds to its own shard of relaxed atomic
+// cells, and render() sums the shards without stopping anyone. The shard
+// follows from a process-wide thread index, the same in every registry, so
+// threads beyond MAX_SHARDS share shards round-robin (correct, contended).
+// Series with the same name form one family and must be registered one
+// after the other; labels are given preformatted ("sensor=\"imu\"").
+class MetricsRegistry {
+
+public:
+    static const int MAX_SHARDS = 16;
+    static const int MAX_CELLS = 1024;
+
+private:
+    enum Kind { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Series {
+        Kind kind;
+        std::string name;
+        std::string help;
+        std::string labels;
+        int cell;                     // first cell (counter, histogram)
+        std::vector<double> bounds;   // histogram upper bounds
+        double scale;                 // histogram sum units per unit
+    };
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> cells[MAX_CELLS];
+    };
+
+    std::vector<Series> series;
+    int cells;
+    std::unique_ptr<Shard[]> shards;
+    std::unique_ptr<std::atomic<uint64_t>[]> gauges;   // double bits, per series
+
+    Shard &local();
+
+public:
+    MetricsRegistry();
+
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+    // drops every series; no thread may be updating
+    void clear();
+
+    // series ids, -1 when the cells are exhausted
+    int counter(const std::string &name, const std::string &help, const std::string &labels = "");
+    int gauge(const std::string &name, const std::string &help, const std::string &labels = "");
+    // bounds ascending, the +Inf bucket is implicit; the sum is kept in
+    // 1/scale units (1e9 with seconds: ns)
+    int histogram(const std::string &name, const std::string &help, const std::string &labels,
+                  const std::vector<double> &bounds, double scale = 1e9);
+
+    // ids < 0 are ignored
+    void add(int counter_id, uint64_t n = 1) {
+        if (counter_id < 0) return;
+        local().cells[series[counter_id].cell].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void set(int gauge_id, double value);
+
+    void observe(int histogram_id, double value);
+
+    // Prometheus text exposition format 0.0.4
+    std::string render() const;
+};
+
+//-----------------------------
+// Metrics server
+//-----------------------------
+// Minimal HTTP/1.0 endpoint that answers every request with render(), on
+// its own thread. The endpoint is "host:port" (TCP, e.g. "127.0.0.1:9464")
+// or "unix:/path" (Unix socket, the file is replaced).
+class MetricsServer {
+
+private:
+    const MetricsRegistry *registry;
+    int fd;
+    std::string unixPath;
+    std::thread thread;
+    std::atomic<bool> stopping;
+
+    void serve();
+
+public:
+    MetricsServer() : registry(nullptr), fd(-1), stopping(false) {}
+    ~MetricsServer() { stop(); }
+
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+    // false when the endpoint is malformed or cannot be bound
+    bool start(const MetricsRegistry &metrics, const std::string &endpoint);
+    void stop();
+    bool is_running() const { return fd >= 0; }
+};
+
+}  // namespace adaptive_filter
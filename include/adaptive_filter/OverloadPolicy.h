@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Overload policy
+//-----------------------------
+// Load mode of a periodic estimator from the lateness and duration of its
+// steps and from its backlog of queued events. The load is the smoothed
+// fraction of the period used by a step (duration plus start lateness), the
+// slack what is left of the period. Modes go up as soon as a threshold is
+// crossed and come back down only after calmSteps steps below hysteresis
+// times the thresholds, so that the mode does not flap.
+enum LoadMode : uint8_t { NORMAL = 0, DEGRADED = 1, OVERLOADED = 2 };
+
+class OverloadPolicy {
+
+private:
+    double period;          // [s]
+    double degradeLoad;
+    double overloadLoad;
+    size_t degradeBacklog;
+    size_t overloadBacklog;
+    double alpha;           // smoothing of the load
+    double hysteresis;
+    int calmSteps;
+
+    double load;
+    size_t backlog;
+    LoadMode mode;
+    int calm;
+
+public:
+    OverloadPolicy(double step_period = 0.005, double degrade_load = 0.7, double overload_load = 0.9,
+                   size_t degrade_backlog = 10, size_t overload_backlog = 40)
+        : period(step_period), degradeLoad(degrade_load), overloadLoad(overload_load),
+          degradeBacklog(degrade_backlog), overloadBacklog(overload_backlog),
+          alpha(0.1), hysteresis(0.8), calmSteps(200) {
+        reset();
+    }
+
+    void configure(double step_period, double degrade_load, double overload_load, size_t degrade_backlog, size_t overload_backlog) {
+        period = step_period;
+        degradeLoad = degrade_load;
+        overloadLoad = overload_load;
+        degradeBacklog = degrade_backlog;
+        overloadBacklog = overload_backlog;
+    }
+
+    void reset() {
+        load = 0;
+        backlog = 0;
+        mode = NORMAL;
+        calm = 0;
+    }
+
+    // lateness of the step start and duration of the step [s], events queued
+    // at its start; returns the mode for the next step
+    LoadMode update(double lateness, double duration, size_t queued) {
+        double used = (std::max(0.0, lateness) + duration)/period;
+        load += alpha*(used - load);
+        backlog = queued;
+
+        LoadMode target = NORMAL;
+        if (load > overloadLoad || backlog >= overloadBacklog){
+            target = OVERLOADED;
+        } else if (load > degradeLoad || backlog >= degradeBacklog){
+            target = DEGRADED;
+        }
+
+        if (target >= mode){
+            mode = target;
+            calm = 0;
+            return mode;
+        }
+
+        // one level down after calmSteps steps clearly below its thresholds
+        double downLoad = mode == OVERLOADED ? overloadLoad : degradeLoad;
+        size_t downBacklog = mode == OVERLOADED ? overloadBacklog : degradeBacklog;
+        if (load < hysteresis*downLoad && backlog < downBacklog/2){
+            if (++calm >= calmSteps){
+                mode = static_cast<LoadMode>(mode - 1);
+                calm = 0;
+            }
+        } else {
+            calm = 0;
+        }
+        return mode;
+    }
+
+    LoadMode current() const { return mode; }
+    double current_load() const { return load; }
+    double slack() const { return period*(1.0 - load); }
+    size_t current_backlog() const { return backlog; }
+};
+
+}  // namespace adaptive_filter
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Hardware counters
+//-----------------------------
+// Cycles, instructions, cache misses and branch misses of the calling thread
+// in user space, opened with perf_event_open as one group so that they are
+// scheduled together. Events the PMU does not have are left out and read as
+// zero. Opening needs perf_event_paranoid <= 2 (or CAP_PERFMON).
+enum PerfEvent { PERF_CYCLES = 0, PERF_INSTRUCTIONS = 1, PERF_CACHE_MISSES = 2, PERF_BRANCH_MISSES = 3, N_PERF_EVENTS = 4 };
+
+class PerfGroup {
+
+private:
+    int fds[N_PERF_EVENTS];
+    int slot[N_PERF_EVENTS];   // position in the group read, -1 when missing
+    int leader;
+    int members;
+    bool tried;
+
+public:
+    PerfGroup() : leader(-1), members(0), tried(false) {
+        std::fill(fds, fds + N_PERF_EVENTS, -1);
+        std::fill(slot, slot + N_PERF_EVENTS, -1);
+    }
+
+    ~PerfGroup() { close(); }
+
+    PerfGroup(const PerfGroup&) = delete;
+    PerfGroup& operator=(const PerfGroup&) = delete;
+
+    bool open() {
+        static const uint64_t configs[N_PERF_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        close();
+        tried = true;
+
+        for (int i = 0; i < N_PERF_EVENTS; i++){
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd < 0){
+                continue;
+            }
+            fds[i] = fd;
+            slot[i] = members++;
+            if (leader < 0){
+                leader = fd;
+            }
+        }
+        if (leader < 0){
+            return false;
+        }
+
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+    }
+
+    void close() {
+        for (int i = 0; i < N_PERF_EVENTS; i++){
+            if (fds[i] >= 0){
+                ::close(fds[i]);
+            }
+            fds[i] = -1;
+            slot[i] = -1;
+        }
+        leader = -1;
+        members = 0;
+    }
+
+    // opened on the first call only
+    bool ready() {
+        if (!tried){
+            open();
+        }
+        return members > 0;
+    }
+
+    bool available(int event) const { return slot[event] >= 0; }
+
+    // running counts since open()
+    bool read(uint64_t (&counts)[N_PERF_EVENTS]) {
+        uint64_t buffer[1 + N_PERF_EVENTS];
+        ssize_t n = ::read(leader, buffer, sizeof(buffer));
+        if (n < static_cast<ssize_t>(sizeof(uint64_t)*(1 + members))){
+            return false;
+        }
+        for (int i = 0; i < N_PERF_EVENTS; i++){
+            counts[i] = slot[i] >= 0 ? buffer[1 + slot[i]] : 0;
+        }
+        return true;
+    }
+};
+
+//-----------------------------
+// Stage profiler
+//-----------------------------
+// Counters accumulated per filter stage by a Scope around it, read from a
+// group of the thread that runs the stage (opened on its first scope). Stages
+// nest, the outer one includes the inner. A read is a system call, so the
+// counts include about a microsecond of it per scope. One thread at a time
+// may profile (the filter step).
+enum ProfileStage : uint8_t { PROFILE_PREDICTION = 0, PROFILE_JACOBIAN = 1, PROFILE_IMU = 2, PROFILE_WHEEL = 3, PROFILE_LIDAR = 4, N_PROFILE_STAGES = 5 };
+
+inline const char *profile_stage_name(uint8_t stage) {
+    static const char *names[N_PROFILE_STAGES] = {"prediction_stage", "jacobian_state", "correction_imu_stage",
+                                                  "correction_wheel_stage", "correction_lidar_stage"};
+    return stage < N_PROFILE_STAGES ? names[stage] : "unknown";
+}
+
+struct StageCounters {
+    uint64_t calls;
+    uint64_t counts[N_PERF_EVENTS];
+};
+
+class StageProfiler {
+
+private:
+    bool enabled;
+    StageCounters stages[N_PROFILE_STAGES];
+
+    static PerfGroup &thread_group() {
+        static thread_local PerfGroup group;
+        return group;
+    }
+
+public:
+    StageProfiler() : enabled(false) {
+        reset();
+    }
+
+    // false when the counters cannot be opened on the calling thread
+    bool enable() {
+        enabled = thread_group().ready();
+        return enabled;
+    }
+
+    void disable() { enabled = false; }
+
+    bool is_enabled() const { return enabled; }
+
+    void reset() {
+        std::memset(stages, 0, sizeof(stages));
+    }
+
+    // counters since the last collect(), then starts over
+    void collect(StageCounters (&out)[N_PROFILE_STAGES]) {
+        std::copy(stages, stages + N_PROFILE_STAGES, out);
+        reset();
+    }
+
+    class Scope {
+    private:
+        StageProfiler &profiler;
+        uint8_t stage;
+        bool counting;
+        uint64_t start[N_PERF_EVENTS];
+
+    public:
+        Scope(StageProfiler &p, ProfileStage s) : profiler(p), stage(s), counting(false) {
+            if (profiler.enabled){
+                PerfGroup &group = thread_group();
+                counting = group.ready() && group.read(start);
+            }
+        }
+
+        ~Scope() {
+            uint64_t end[N_PERF_EVENTS];
+            if (!counting || !thread_group().read(end)){
+                return;
+            }
+            StageCounters &counters = profiler.stages[stage];
+            counters.calls++;
+            for (int i = 0; i < N_PERF_EVENTS; i++){
+                counters.counts[i] += end[i] - start[i];
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+};
+
+}  // namespace adaptive_filter
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Pool allocator
+//-----------------------------
+// Standard allocator on top of a process-wide synchronized pool resource.
+// Blocks are returned to the pool instead of the heap, so once the pools
+// hold enough blocks for the in-flight messages (after warm-up) allocations
+// through rclcpp publishers and subscriptions no longer reach malloc.
+inline std::pmr::memory_resource *message_pool() {
+    static std::pmr::synchronized_pool_resource pool;
+    return &pool;
+}
+
+template <typename T>
+class PoolAllocator {
+
+public:
+    typedef T value_type;
+
+    std::pmr::memory_resource *resource;
+
+    PoolAllocator() noexcept : resource(message_pool()) {}
+
+    explicit PoolAllocator(std::pmr::memory_resource *r) noexcept : resource(r) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &other) noexcept : resource(other.resource) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T*>(resource->allocate(n*sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        resource->deallocate(p, n*sizeof(T), alignof(T));
+    }
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U> other;
+    };
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T> &a, const PoolAllocator<U> &b) noexcept {
+    return a.resource == b.resource;
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T> &a, const PoolAllocator<U> &b) noexcept {
+    return a.resource != b.resource;
+}
+
+}  // namespace adaptive_filter
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <mutex>
+#include <vector>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Pose history
+//-----------------------------
+// Preallocated ring buffer of (stamp, pose, covariance) written by the
+// filter and queried at arbitrary stamps. Lookup is a binary search over the
+// stored stamps; positions and covariances are interpolated linearly and
+// orientations with SLERP. Stamps past the newest entry are extrapolated
+// from the last two entries, at most maxExtrapolation seconds ahead.
+class PoseHistory {
+
+public:
+    typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+
+    struct Entry {
+        double stamp;
+        Eigen::Vector3d position;
+        Eigen::Quaterniond orientation;
+        Matrix6d covariance;
+    };
+
+    enum Result { NONE = 0, INTERPOLATED, EXTRAPOLATED };
+
+private:
+    std::vector<Entry> buffer;
+    size_t head;    // index of the oldest entry
+    size_t count;
+    double maxExtrapolation;
+
+    mutable std::mutex mtx;
+
+    const Entry &at(size_t i) const { return buffer[(head + i) % buffer.size()]; }
+
+    static void interpolate(const Entry &a, const Entry &b, double stamp, Entry &out) {
+        double s = (stamp - a.stamp)/(b.stamp - a.stamp);
+        out.stamp = stamp;
+        out.position = a.position + s*(b.position - a.position);
+        out.orientation = a.orientation.slerp(s, b.orientation).normalized();
+        out.covariance = a.covariance + s*(b.covariance - a.covariance);
+    }
+
+public:
+    explicit PoseHistory(size_t capacity = 1000, double max_extrapolation = 0.05)
+        : buffer(capacity > 1 ? capacity : 2), head(0), count(0), maxExtrapolation(max_extrapolation) {}
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mtx);
+        head = 0;
+        count = 0;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return count;
+    }
+
+    // stamps must increase, entries older than the newest one are ignored
+    void push(double stamp, const Eigen::Vector3d &position, const Eigen::Quaterniond &orientation, const Matrix6d &covariance) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (count > 0 && stamp <= at(count - 1).stamp){
+            return;
+        }
+
+        Entry *e;
+        if (count < buffer.size()){
+            e = &buffer[(head + count) % buffer.size()];
+            count++;
+        } else {
+            e = &buffer[head];
+            head = (head + 1) % buffer.size();
+        }
+        e->stamp = stamp;
+        e->position = position;
+        e->orientation = orientation;
+        e->covariance = covariance;
+    }
+
+    Result query(double stamp, Entry &out) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (count == 0 || stamp < at(0).stamp){
+            return NONE;
+        }
+
+        const Entry &newest = at(count - 1);
+        if (stamp >= newest.stamp){
+            if (stamp - newest.stamp > maxExtrapolation){
+                return NONE;
+            }
+            if (stamp == newest.stamp || count == 1){
+                out = newest;
+                out.stamp = stamp;
+                return stamp == newest.stamp ? INTERPOLATED : EXTRAPOLATED;
+            }
+            // s > 1 continues the motion of the last interval
+            interpolate(at(count - 2), newest, stamp, out);
+            return EXTRAPOLATED;
+        }
+
+        // first entry newer than stamp
+        size_t lo = 1, hi = count - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi)/2;
+            if (at(mid).stamp <= stamp){
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        interpolate(at(lo - 1), at(lo), stamp, out);
+        return INTERPOLATED;
+    }
+};
+
+}  // namespace adaptive_filter
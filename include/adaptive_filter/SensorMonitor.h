@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Sensor monitor
+//-----------------------------
+// Arrival statistics of one input, O(1) per sample and without allocation.
+// The window accumulators are read and restarted by summarize(); the totals
+// run from reset(). Inter-arrival times use the host arrival time, gaps
+// and drops the header stamps (a stamp interval longer than gapFactor
+// expected periods is a gap, the periods missing in it are drops).
+struct SensorSummary {
+    double rate;            // [Hz] over the window
+    double expectedRate;    // [Hz]
+    double periodMean;      // [s] inter-arrival time
+    double periodJitter;    // [s] standard deviation of the inter-arrival time
+    double periodMax;       // [s]
+    double latencyMean;     // [s] arrival time minus header stamp
+    double latencyMax;      // [s]
+    uint32_t samples;
+    uint32_t gaps;
+    uint32_t drops;
+    uint32_t outOfOrder;    // stamps not newer than the previous one
+    uint64_t totalSamples;
+    uint64_t totalGaps;
+    uint64_t totalDrops;
+    bool alarm;             // rate below alarmRatio of the expected rate
+};
+
+class SensorMonitor {
+
+private:
+    double expectedPeriod;   // [s], 0 when unknown
+    double alarmRatio;
+    double gapFactor;
+
+    bool hasLast;
+    double lastStamp;
+    double lastArrival;
+
+    double windowStart;
+    uint32_t count;
+    uint32_t intervals;
+    double sumDt, sumDt2, maxDt;
+    double sumLatency, maxLatency;
+    uint32_t gaps, drops, outOfOrder;
+
+    uint64_t totalSamples, totalGaps, totalDrops;
+
+    void restart(double now) {
+        windowStart = now;
+        count = 0;
+        intervals = 0;
+        sumDt = sumDt2 = maxDt = 0;
+        sumLatency = 0;
+        maxLatency = -INFINITY;
+        gaps = drops = outOfOrder = 0;
+    }
+
+public:
+    explicit SensorMonitor(double expected_rate = 0, double alarm_ratio = 0.8, double gap_factor = 1.5) {
+        configure(expected_rate, alarm_ratio, gap_factor);
+        reset(0);
+    }
+
+    void configure(double expected_rate, double alarm_ratio, double gap_factor = 1.5) {
+        expectedPeriod = expected_rate > 0 ? 1.0/expected_rate : 0;
+        alarmRatio = alarm_ratio;
+        gapFactor = gap_factor;
+    }
+
+    void reset(double now) {
+        hasLast = false;
+        lastStamp = lastArrival = 0;
+        totalSamples = totalGaps = totalDrops = 0;
+        restart(now);
+    }
+
+    // stamp: header stamp, arrival: host time at reception [s]
+    void sample(double stamp, double arrival) {
+        count++;
+        totalSamples++;
+
+        double latency = arrival - stamp;
+        sumLatency += latency;
+        maxLatency = std::max(maxLatency, latency);
+
+        if (hasLast){
+            double dt = arrival - lastArrival;
+            intervals++;
+            sumDt += dt;
+            sumDt2 += dt*dt;
+            maxDt = std::max(maxDt, dt);
+
+            double ds = stamp - lastStamp;
+            if (ds <= 0){
+                outOfOrder++;
+            } else if (expectedPeriod > 0 && ds > gapFactor*expectedPeriod){
+                uint32_t missing = static_cast<uint32_t>(std::lround(ds/expectedPeriod)) - 1;
+                gaps++;
+                drops += missing;
+                totalGaps++;
+                totalDrops += missing;
+            }
+        }
+
+        hasLast = true;
+        lastStamp = std::max(lastStamp, stamp);
+        lastArrival = arrival;
+    }
+
+    // statistics of the window that ends now, then starts the next one
+    void summarize(double now, SensorSummary &out) {
+        double span = now - windowStart;
+
+        out.rate = span > 0 ? count/span : 0;
+        out.expectedRate = expectedPeriod > 0 ? 1.0/expectedPeriod : 0;
+        out.periodMean = intervals > 0 ? sumDt/intervals : 0;
+        out.periodJitter = intervals > 1 ? std::sqrt(std::max(0.0, sumDt2/intervals - out.periodMean*out.periodMean)) : 0;
+        out.periodMax = maxDt;
+        out.latencyMean = count > 0 ? sumLatency/count : 0;
+        out.latencyMax = count > 0 ? maxLatency : 0;
+        out.samples = count;
+        out.gaps = gaps;
+        out.drops = drops;
+        out.outOfOrder = outOfOrder;
+        out.totalSamples = totalSamples;
+        out.totalGaps = totalGaps;
+        out.totalDrops = totalDrops;
+        out.alarm = expectedPeriod > 0 && out.rate < alarmRatio*out.expectedRate;
+
+        restart(now);
+    }
+};
+
+}  // namespace adaptive_filter
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Shared-memory filter state
+//-----------------------------
+// Latest filter state (stamp, X, P) in a POSIX shared-memory segment guarded
+// by a seqlock, for consumers on the same host that cannot afford a DDS
+// round trip. There is a single writer (the filter); readers never block it
+// and never take a lock: a read copies the state and checks that the
+// sequence number did not move meanwhile. The segment records the pid of its
+// writer, so a second filter cannot take over a name that is still in use.
+struct SharedStateSnapshot {
+    uint64_t sequence;   // number of states written so far
+    double stamp;        // [s]
+    double X[12];        // {x, y, z, roll, pitch, yaw, vx, vy, vz, wx, wy, wz}
+    double P[144];       // 12x12 covariance, column-major
+};
+
+struct SharedStateSegment {
+    static const uint32_t MAGIC = 0x41465353;   // "AFSS"
+    static const uint32_t VERSION = 2;
+
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<int32_t> owner;  // pid of the writer
+    std::atomic<uint64_t> seq;   // odd while a write is in progress
+    SharedStateSnapshot state;
+};
+
+class SharedStateWriter {
+
+private:
+    std::string name;
+    SharedStateSegment *segment;
+
+public:
+    SharedStateWriter() : segment(nullptr) {}
+    ~SharedStateWriter() { close(); }
+
+    SharedStateWriter(const SharedStateWriter &) = delete;
+    SharedStateWriter &operator=(const SharedStateWriter &) = delete;
+
+    // creates the segment, name as for shm_open ("/..."); an existing one is
+    // only taken over when its writer process is gone, and its sequence
+    // continues. Fails while another writer owns it.
+    bool open(const std::string &segment_name);
+    // unmaps the segment and unlinks it if still the owner
+    void close();
+    bool is_open() const { return segment != nullptr; }
+
+    void write(double stamp, const double *X, const double *P);
+};
+
+class SharedStateReader {
+
+private:
+    const SharedStateSegment *segment;
+
+public:
+    SharedStateReader() : segment(nullptr) {}
+    ~SharedStateReader() { close(); }
+
+    SharedStateReader(const SharedStateReader &) = delete;
+    SharedStateReader &operator=(const SharedStateReader &) = delete;
+
+    // fails while the filter has not created the segment yet
+    bool open(const std::string &segment_name);
+    void close();
+    bool is_open() const { return segment != nullptr; }
+
+    // single attempt, false if the writer was active during the copy or
+    // nothing has been written yet; never waits
+    bool try_read(SharedStateSnapshot &out) const;
+
+    // retries try_read up to max_attempts times
+    bool read(SharedStateSnapshot &out, int max_attempts = 16) const;
+};
+
+}  // namespace adaptive_filter
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Triple buffer
+//-----------------------------
+// Wait-free single-writer single-reader exchange of the latest value. The
+// writer fills its back slot and swaps it with the middle one; the reader
+// swaps its front slot with the middle one when the middle holds a value it
+// has not seen. Neither side ever blocks or retries.
+template <typename T>
+class TripleBuffer {
+
+private:
+    static const uint8_t INDEX = 0x3;
+    static const uint8_t FRESH = 0x4;
+
+    T slots[3];
+    std::atomic<uint8_t> middle;
+    uint8_t back;    // writer only
+    uint8_t front;   // reader only
+
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+
+    // writer
+    T &write_slot() { return slots[back]; }
+    void publish() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX; }
+
+    // reader: true when a newer value than read_slot() was taken
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T &read_slot() const { return slots[front]; }
+};
+
+//-----------------------------
+// Snapshot broadcast
+//-----------------------------
+// One writer, up to MAX_READERS readers, each with its own triple buffer so
+// that every reader sees the latest value without affecting the others.
+template <typename T, int MAX_READERS = 4>
+class SnapshotBroadcast {
+
+private:
+    TripleBuffer<T> buffers[MAX_READERS];
+    std::atomic<int> nReaders;
+
+public:
+    SnapshotBroadcast() : nReaders(0) {}
+
+    // nullptr when all reader slots are taken; the count never goes past
+    // MAX_READERS, not even transiently, so write() stays in bounds
+    TripleBuffer<T> *add_reader() {
+        int i = nReaders.load(std::memory_order_relaxed);
+        do {
+            if (i >= MAX_READERS){
+                return nullptr;
+            }
+        } while (!nReaders.compare_exchange_weak(i, i + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+        return &buffers[i];
+    }
+
+    void write(const T &value) {
+        int n = std::min(nReaders.load(std::memory_order_acquire), MAX_READERS);
+        for (int i = 0; i < n; i++){
+            buffers[i].write_slot() = value;
+            buffers[i].publish();
+        }
+    }
+};
+
+//-----------------------------
+// Filter state snapshot
+//-----------------------------
+struct StateSnapshot {
+    // state at the end of a filter cycle
+    double stamp;   // [s]
+    Eigen::Matrix<double, 12, 1> X;
+    Eigen::Matrix<double, 12, 12> P;
+    Eigen::Matrix<double, 12, 12> Q;   // process noise of one step
+
+    // state of the last filterFreq output request and its stamp
+    uint64_t odomSeq;
+    int64_t odomStamp;   // [ns]
+    Eigen::Matrix<double, 12, 1> odomX;
+    Eigen::Matrix<double, 12, 12> odomP;
+
+    // filter step that wrote it, and the initialization it belongs to
+    uint64_t step;
+    uint64_t epoch;
+
+    // load mode of the filter (OverloadPolicy.h)
+    uint8_t loadMode;
+};
+
+}  // namespace adaptive_filter
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+
+//-----------------------------
+// USDT probes
+//-----------------------------
+// Static tracepoints of the filter under the provider "adaptive_filter",
+// compiled in with ADAPTIVE_FILTER_USDT (needs <sys/sdt.h>). An untraced
+// probe is a nop plus a note in the ELF; bpftrace, perf or systemtap attach
+// to it at run time. Stamps are in ns, sequence numbers count the messages
+// received per sensor, the filter steps or the published outputs.
+//
+//   receive(sensor, seq, stamp)          message handed to the filter
+//   predict_start(step, stamp)           prediction of a filter step
+//   predict_end(step, stamp)
+//   correct_start(sensor, seq, stamp)    correction with the message seq
+//   correct_end(sensor, seq, stamp)
+//   publish(output, seq, stamp)          output published
+#if defined(ADAPTIVE_FILTER_USDT)
+#include <sys/sdt.h>
+#define ADAPTIVE_FILTER_PROBE2(name, a, b) DTRACE_PROBE2(adaptive_filter, name, a, b)
+#define ADAPTIVE_FILTER_PROBE3(name, a, b, c) DTRACE_PROBE3(adaptive_filter, name, a, b, c)
+#else
+// the arguments are not evaluated
+#define ADAPTIVE_FILTER_PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define ADAPTIVE_FILTER_PROBE3(name, a, b, c) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#endif
+
+namespace adaptive_filter {
+
+// sensor argument
+enum TraceSensor : int { TRACE_IMU = 0, TRACE_WHEEL = 1, TRACE_LIDAR = 2 };
+
+// output argument
+enum TraceOutput : int {
+    TRACE_ODOM = 0,             // filterFreq odometry, seq of the output request
+    TRACE_OUTPUT = 1,           // extrapolated odometry (outputRate), step
+    TRACE_FILTER_STATE = 2,     // compact state, its seq
+    TRACE_TF = 3,               // transform, step
+    TRACE_HEALTH = 4,           // health summary, steps so far
+    TRACE_INDIRECT_LIDAR = 5,   // indirect LiDAR measurement, LiDAR seq
+    TRACE_OVERRUN = 6           // step overrun, step
+};
+
+}  // namespace adaptive_filter
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Work-stealing thread pool
+//-----------------------------
+// Fixed pool of worker threads that executes strands. A strand is a FIFO of
+// tasks belonging to one filter instance: its tasks run one at a time and in
+// posting order, but different strands run in parallel. Tasks are stored in
+// a fixed ring per strand, so posting does not allocate. Each worker keeps a
+// deque of the strands its own tasks made ready, served LIFO while they are
+// hot in its cache, and a FIFO injection queue for strands posted from
+// outside the pool (round robin over the workers) and strands that used up
+// their budget; the injection queue is served after the deque, oldest first,
+// so externally posted filters run in posting order and a busy filter cannot
+// starve the ones sharing its worker. Workers that run dry steal the oldest
+// strand of another worker, injected first.
+class WorkStealingPool {
+
+public:
+    //-----------------------------
+    // Inline task
+    //-----------------------------
+    // Callable stored in place, so that posting never allocates: a callable
+    // larger than CAPACITY does not compile.
+    class Task {
+
+    public:
+        static const size_t CAPACITY = 512;
+
+    private:
+        alignas(std::max_align_t) unsigned char storage[CAPACITY];
+        void (*call)(unsigned char*);
+        void (*destroy)(unsigned char*);
+
+    public:
+        Task() : call(nullptr), destroy(nullptr) {}
+        ~Task() { reset(); }
+
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        template <typename F>
+        void assign(F &&f) {
+            typedef typename std::decay<F>::type Fn;
+            static_assert(sizeof(Fn) <= CAPACITY, "task too large for WorkStealingPool::Task::CAPACITY");
+            static_assert(alignof(Fn) <= alignof(std::max_align_t), "task over-aligned");
+            reset();
+            new (storage) Fn(std::forward<F>(f));
+            call = [](unsigned char *p) { (*reinterpret_cast<Fn*>(p))(); };
+            destroy = [](unsigned char *p) { reinterpret_cast<Fn*>(p)->~Fn(); };
+        }
+
+        void reset() {
+            if (destroy){
+                destroy(storage);
+            }
+            call = nullptr;
+            destroy = nullptr;
+        }
+
+        void operator()() { call(storage); }
+    };
+
+    class Strand {
+        friend class WorkStealingPool;
+
+    private:
+        WorkStealingPool &pool;
+        std::mutex mtx;
+
+        // ring of preallocated tasks; the head stays in place while it runs
+        std::unique_ptr<Task[]> tasks;
+        size_t capacity;
+        size_t head;
+        size_t count;
+        bool executing;
+        bool scheduled;
+
+        Strand(WorkStealingPool &p, size_t task_capacity)
+            : pool(p), tasks(new Task[task_capacity]), capacity(task_capacity), head(0), count(0), executing(false), scheduled(false) {}
+
+        // runs up to budget tasks, returns true when tasks are left
+        bool run(size_t budget) {
+            for (size_t i = 0; i < budget; i++){
+                Task *task;
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    if (count == 0){
+                        scheduled = false;
+                        return false;
+                    }
+                    task = &tasks[head];
+                    executing = true;
+                }
+                (*task)();
+                task->reset();
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    head = (head + 1) % capacity;
+                    count--;
+                    executing = false;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mtx);
+            if (count == 0){
+                scheduled = false;
+                return false;
+            }
+            return true;
+        }
+
+    public:
+        // false (and the task dropped) when the ring is full
+        template <typename F>
+        bool post(F &&f) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (count == capacity){
+                    return false;
+                }
+                tasks[(head + count) % capacity].assign(std::forward<F>(f));
+                count++;
+                if (scheduled) return true;
+                scheduled = true;
+            }
+            pool.schedule(this);
+            return true;
+        }
+
+        // tasks posted and not started yet
+        size_t queued() {
+            std::lock_guard<std::mutex> lock(mtx);
+            return count - (executing ? 1 : 0);
+        }
+    };
+
+private:
+    // ring of ready strands, with room for every strand (a strand is in at
+    // most one queue at a time)
+    struct Queue {
+        std::mutex mtx;
+        std::vector<Strand*> ring;
+        size_t head = 0;
+        size_t count = 0;
+
+        void grow(size_t capacity) {
+            std::vector<Strand*> larger(capacity, nullptr);
+            for (size_t i = 0; i < count; i++){
+                larger[i] = ring[(head + i) % ring.size()];
+            }
+            ring.swap(larger);
+            head = 0;
+        }
+        void push_back(Strand *strand) { ring[(head + count++) % ring.size()] = strand; }
+        Strand *pop_back() { return ring[(head + --count) % ring.size()]; }
+        Strand *pop_front() { Strand *strand = ring[head]; head = (head + 1) % ring.size(); count--; return strand; }
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;       // LIFO, posted by the worker
+    std::vector<std::unique_ptr<Queue>> injections;   // FIFO, posted from outside or yielded
+    std::vector<std::thread> workers;
+
+    std::mutex strandMtx;
+    size_t nStrands;
+
+    std::mutex sleepMtx;
+    std::condition_variable wakeUp;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> nextQueue;
+    std::atomic<bool> stop;
+
+    // tasks a strand may run before it goes back to a queue, and the tasks
+    // a strand can hold
+    size_t budget;
+    size_t strandCapacity;
+
+    static int &current_worker() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+public:
+    explicit WorkStealingPool(size_t n_threads, size_t strand_budget = 16, size_t strand_capacity = 256)
+        : nStrands(0), pending(0), nextQueue(0), stop(false), budget(strand_budget), strandCapacity(std::max<size_t>(strand_capacity, 1)) {
+        if (n_threads == 0){
+            n_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < n_threads; i++){
+            queues.emplace_back(new Queue());
+            injections.emplace_back(new Queue());
+        }
+        for (size_t i = 0; i < n_threads; i++){
+            workers.emplace_back(&WorkStealingPool::worker, this, i);
+        }
+    }
+
+    ~WorkStealingPool() {
+        shutdown();
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    // the only allocations of the pool: the strand and room for it in every
+    // queue; strands are never removed. Safe to call from any thread.
+    std::shared_ptr<Strand> make_strand() {
+        std::shared_ptr<Strand> strand(new Strand(*this, strandCapacity));
+        std::lock_guard<std::mutex> strands(strandMtx);
+        nStrands++;
+        for (size_t i = 0; i < queues.size(); i++){
+            for (Queue *q : {queues[i].get(), injections[i].get()}){
+                std::lock_guard<std::mutex> lock(q->mtx);
+                q->grow(nStrands);
+            }
+        }
+        return strand;
+    }
+
+    // stops and joins the workers, tasks not yet started are dropped
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMtx);
+            if (stop) return;
+            stop = true;
+        }
+        wakeUp.notify_all();
+        for (auto &w : workers){
+            w.join();
+        }
+    }
+
+private:
+    // strands posted from a worker stay on that worker's deque; strands
+    // posted from outside and strands yielding after their budget queue up
+    // behind the injected ones
+    void schedule(Strand *strand, bool yielded = false) {
+        int self = current_worker();
+        Queue &q = self < 0 ? *injections[nextQueue++ % injections.size()] :
+                   yielded ? *injections[self] : *queues[self];
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(q.mtx);
+            q.push_back(strand);
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMtx);
+        }
+        wakeUp.notify_one();
+    }
+
+    Strand *pop(size_t self) {
+        {
+            Queue &q = *queues[self];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if (q.count > 0) return q.pop_back();
+        }
+        Queue &q = *injections[self];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (q.count == 0) return nullptr;
+        return q.pop_front();
+    }
+
+    Strand *steal(size_t self) {
+        for (size_t i = 1; i < queues.size(); i++){
+            size_t other = (self + i) % queues.size();
+            for (Queue *q : {injections[other].get(), queues[other].get()}){
+                std::lock_guard<std::mutex> lock(q->mtx);
+                if (q->count > 0) return q->pop_front();
+            }
+        }
+        return nullptr;
+    }
+
+    void worker(size_t self) {
+        current_worker() = int(self);
+
+        while (true) {
+            Strand *strand = pop(self);
+            if (!strand){
+                strand = steal(self);
+            }
+            if (!strand){
+                std::unique_lock<std::mutex> lock(sleepMtx);
+                wakeUp.wait(lock, [this] { return stop || pending > 0; });
+                if (stop) return;
+                continue;
+            }
+
+            pending--;
+            if (strand->run(budget)){
+                schedule(strand, true);
+            }
+        }
+    }
+};
+
+}  // namespace adaptive_filter
@@ -0,0 +1,112 @@
+#include <adaptive_filter/AllocTracker.h>
+
+#include <atomic>
+#include <cerrno>
+#include <malloc.h>
+
+// glibc's own allocator, under the names it keeps for replacements
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+void *__libc_memalign(size_t alignment, size_t size);
+void *__libc_valloc(size_t size);
+}
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Counters
+//-----------------------------
+struct alignas(64) TagCounters {
+    std::atomic<uint64_t> allocs;
+    std::atomic<uint64_t> bytes;
+};
+
+// zero-initialized before any constructor runs, so usable by the first malloc
+static TagCounters counters[N_ALLOC_TAGS];
+static std::atomic<uint64_t> frees;
+static thread_local AllocTag currentTag = ALLOC_OTHER;
+
+static inline void *count(void *ptr) {
+    if (ptr){
+        TagCounters &c = counters[currentTag];
+        c.allocs.fetch_add(1, std::memory_order_relaxed);
+        c.bytes.fetch_add(malloc_usable_size(ptr), std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+bool alloc_tracking() {
+    return true;
+}
+
+void alloc_counters(AllocCounters &out) {
+    for (int i = 0; i < N_ALLOC_TAGS; i++){
+        out.allocs[i] = counters[i].allocs.load(std::memory_order_relaxed);
+        out.bytes[i] = counters[i].bytes.load(std::memory_order_relaxed);
+    }
+    out.frees = frees.load(std::memory_order_relaxed);
+}
+
+AllocTag alloc_tag(AllocTag tag) {
+    AllocTag previous = currentTag;
+    currentTag = tag < N_ALLOC_TAGS ? tag : ALLOC_OTHER;
+    return previous;
+}
+
+}  // namespace adaptive_filter
+
+//-----------------------------
+// Replacements
+//-----------------------------
+// Defined in the executable, they take the place of the libc ones for every
+// library of the process (operator new included); the aligned variants are
+// replaced too, since their blocks come back through free().
+extern "C" {
+
+void *malloc(size_t size) {
+    return adaptive_filter::count(__libc_malloc(size));
+}
+
+void *calloc(size_t n, size_t size) {
+    return adaptive_filter::count(__libc_calloc(n, size));
+}
+
+void *realloc(void *ptr, size_t size) {
+    return adaptive_filter::count(__libc_realloc(ptr, size));
+}
+
+void free(void *ptr) {
+    if (ptr){
+        adaptive_filter::frees.fetch_add(1, std::memory_order_relaxed);
+    }
+    __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    return adaptive_filter::count(__libc_memalign(alignment, size));
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return adaptive_filter::count(__libc_memalign(alignment, size));
+}
+
+void *valloc(size_t size) {
+    return adaptive_filter::count(__libc_valloc(size));
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0){
+        return EINVAL;
+    }
+    void *ptr = adaptive_filter::count(__libc_memalign(alignment, size));
+    if (!ptr){
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+}
@@ -1,4 +1,6 @@
 #include <rclcpp/rclcpp.hpp>
+#include <rclcpp_lifecycle/lifecycle_node.hpp>
+#include <rclcpp_lifecycle/lifecycle_publisher.hpp>
 #include <std_msgs/msg/header.hpp>
 #include <sensor_msgs/msg/imu.hpp>
 #include <nav_msgs/msg/odometry.hpp>
@@ -8,7 +10,61 @@
 #include <tf2_ros/transform_listener.h>
 #include <tf2/transform_datatypes.h>
 #include <Eigen/Dense>
+#include <rclcpp/message_memory_strategy.hpp>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <limits>
 #include <mutex>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <adaptive_filter/msg/filter_consistency.hpp>
+#include <adaptive_filter/msg/filter_state.hpp>
+#include <adaptive_filter/msg/sensor_health.hpp>
+#include <adaptive_filter/msg/step_overrun.hpp>
+#include <adaptive_filter/srv/get_filter_pose.hpp>
+#include <adaptive_filter/CdrParser.h>
+#include <adaptive_filter/ClockSync.h>
+#include <adaptive_filter/ConsistencyMonitor.h>
+#include <adaptive_filter/DeadlineMonitor.h>
+#include <adaptive_filter/Metrics.h>
+#include <adaptive_filter/PoolAllocator.h>
+#include <adaptive_filter/PoseHistory.h>
+#include <adaptive_filter/OverloadPolicy.h>
+#include <adaptive_filter/PerfCounters.h>
+#include <adaptive_filter/AllocTracker.h>
+#include <adaptive_filter/SensorMonitor.h>
+#include <adaptive_filter/SharedState.h>
+#include <adaptive_filter/StateSnapshots.h>
+#include <adaptive_filter/Tracepoints.h>
+#include <adaptive_filter/WorkStealingPool.h>
+
+using adaptive_filter::ClockSync;
+using adaptive_filter::DeadlineMonitor;
+using adaptive_filter::DeadlineSummary;
+using adaptive_filter::ImuMeasurement;
+using adaptive_filter::LoadMode;
+using adaptive_filter::MetricsRegistry;
+using adaptive_filter::MetricsServer;
+using adaptive_filter::NisMonitor;
+using adaptive_filter::NisSummary;
+using adaptive_filter::OdometryMeasurement;
+using adaptive_filter::OverloadPolicy;
+using adaptive_filter::PoolAllocator;
+using adaptive_filter::PoseHistory;
+using adaptive_filter::SensorMonitor;
+using adaptive_filter::SensorSummary;
+using adaptive_filter::SharedStateWriter;
+using adaptive_filter::StageCounters;
+using adaptive_filter::StageProfiler;
+using adaptive_filter::AllocCounters;
+using adaptive_filter::StateSnapshot;
+using adaptive_filter::StepOverrun;
+using adaptive_filter::WorkStealingPool;
 
 using namespace Eigen;
 using namespace std;
@@ -18,39 +74,206 @@ using namespace std;
 //-----------------------------
 #define PI 3.14159265
 
-bool enableFilter;
-bool enableImu;
-bool enableWheel;
-bool enableLidar;
-
-float lidarG;
-float wheelG;
-float imuG;
+//-----------------------------
+// Fixed-size types
+//-----------------------------
+typedef Eigen::Matrix<double, 12, 1> Vector12d;
+typedef Eigen::Matrix<double, 12, 12> Matrix12d;
+typedef Eigen::Matrix<double, 9, 1> Vector9d;
+typedef Eigen::Matrix<double, 9, 9> Matrix9d;
+typedef Eigen::Matrix<double, 6, 1> Vector6d;
+typedef Eigen::Matrix<double, 6, 6> Matrix6d;
 
-std::string filterFreq;
+//-----------------------------
+// Filter parameters
+//-----------------------------
+struct FilterParameters {
+    bool enableFilter = true;
+    bool enableImu = true;
+    bool enableWheel = true;
+    bool enableLidar = true;
+
+    float lidarG = 1000;
+    float wheelG = 0.05;
+    float imuG = 0.1;
+
+    std::string filterFreq = "l";
+
+    // TF broadcast rate [Hz] (0 disables) and whether to skip it without listeners
+    double tfRate = 0.0;
+    bool tfOnlyWithListeners = true;
+
+    // frames of the filtered pose (odometry, TF and pose service); in pool
+    // mode they default to "<name>/<frame>"
+    std::string parentFrame = "chassis_init";
+    std::string childFrame = "ekf_odom_frame";
+
+    // output rate [Hz] of the extrapolated state, replaces filterFreq when > 0
+    double outputRate = 0.0;
+
+    // compact state output rate [Hz] (0 disables it) and covariance ("diagonal" or "triangular")
+    double compactRate = 0.0;
+    std::string compactCovariance = "diagonal";
+
+    // pose history length [entries] and how far past its newest pose it may extrapolate [s]
+    int historySize = 1000;
+    double historyMaxExtrapolation = 0.05;
+
+    // POSIX shared-memory segment with the latest state ("" disables it)
+    std::string sharedStateName = "";
+
+    // take the inputs serialized and decode only the used fields
+    bool serializedInput = false;
+
+    // reliability of the sensor subscriptions, "reliable" or "best_effort"
+    std::string sensorQos = "reliable";
+
+    // fuse the IMU samples queued since the last step as one measurement
+    bool imuAggregate = false;
+
+    // input health summary rate [Hz] (0 disables it), expected input rates [Hz]
+    // and the fraction of them below which a sensor is in alarm
+    double healthRate = 1.0;
+    double imuExpectedRate = 100.0;
+    double wheelExpectedRate = 20.0;
+    double lidarExpectedRate = 10.0;
+    double rateAlarmRatio = 0.8;
+
+    // estimate the sensor clock offsets and use the corrected stamps
+    bool timeSync = false;
+
+    // load shedding: share of the 5 ms step and queued events above which
+    // the filter degrades (coalesced IMU, no debug outputs) or is overloaded
+    // (also halved output rates, LiDAR correction first)
+    bool loadShedding = true;
+    double degradeLoad = 0.7;
+    double overloadLoad = 0.9;
+    int degradeBacklog = 10;
+    int overloadBacklog = 40;
+
+    // deadline of the filter step [s] and whether overruns are published
+    double stepDeadline = 0.005;
+    bool overrunTopic = false;
+
+    // report rate [Hz] of the hardware counters per filter stage (0 disables
+    // the profiling)
+    double profileRate = 0.0;
+
+    // report rate [Hz] of the allocations per stage and callback and of the
+    // RSS (ADAPTIVE_FILTER_ALLOC_TRACKING builds, 0 disables it)
+    double allocRate = 0.0;
+
+    // confidence level of the NIS bounds and whether the consistency summary
+    // is published
+    double nisConfidence = 0.95;
+    bool consistencyTopic = false;
+
+    // Prometheus endpoint, "host:port" or "unix:/path" ("" disables it)
+    std::string metricsEndpoint = "";
+};
 
-std::mutex mtx;
+template <typename NodeT>
+FilterParameters get_filter_parameters(NodeT *nh_, const std::string &prefix, const FilterParameters &defaults);
 
 //-----------------------------
 // LiDAR Odometry class
 //-----------------------------
-class AdaptiveFilter : public rclcpp::Node {
+class AdaptiveFilter : public rclcpp_lifecycle::LifecycleNode {
+
+    // test/test_allocations.cpp drives the handlers and the step directly
+    friend class AdaptiveFilterTest;
 
 private:
+    typedef rclcpp_lifecycle::node_interfaces::LifecycleNodeInterface::CallbackReturn CallbackReturn;
+
+    // Parameters (applied on configure) and topic prefix
+    FilterParameters filterParameters;
+    std::string topicPrefix;
+
+    // Measurements are delivered to the filter only while active
+    std::atomic<bool> active;
+
+    bool enableFilter;
+    bool enableImu;
+    bool enableWheel;
+    bool enableLidar;
+
+    float lidarG;
+    float wheelG;
+    float imuG;
+
+    std::string filterFreq;
+
+    double tfRate;
+    bool tfOnlyWithListeners;
+    std::string parentFrame;
+    std::string childFrame;
+
+    double outputRate;
+
+    double compactRate;
+    std::string compactCovariance;
+
+    int historySize;
+    double historyMaxExtrapolation;
+
+    std::string sharedStateName;
+
+    bool serializedInput;
+    std::string sensorQos;
+
+    bool imuAggregate;
+
+    double healthRate;
+    double rateAlarmRatio;
+
+    bool timeSync;
+
+    bool loadShedding;
+
+    bool overrunTopic;
+
+    double profileRate;
+    double allocRate;
+
+    bool consistencyTopic;
+
+    // Strand of a shared thread pool that serializes the filter events (pool mode)
+    std::shared_ptr<WorkStealingPool::Strand> strand;
+    rclcpp::TimerBase::SharedPtr timer;
+
+    // Message allocator (pooled, see PoolAllocator.h)
+    typedef PoolAllocator<void> Alloc;
+    std::shared_ptr<Alloc> alloc;
+    bool intraProcess;
+
     // Subscriber
-    rclcpp::Subscription<sensor_msgs::msg::Imu>::SharedPtr subImu;
-    rclcpp::Subscription<nav_msgs::msg::Odometry>::SharedPtr subWheelOdometry;
-    rclcpp::Subscription<nav_msgs::msg::Odometry>::SharedPtr subLaserOdometry;
+    rclcpp::Subscription<sensor_msgs::msg::Imu, Alloc>::SharedPtr subImu;
+    rclcpp::Subscription<nav_msgs::msg::Odometry, Alloc>::SharedPtr subWheelOdometry;
+    rclcpp::Subscription<nav_msgs::msg::Odometry, Alloc>::SharedPtr subLaserOdometry;
 
     // Publisher
-    rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr pubFilteredOdometry;
-    rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr pubIndLiDARMeasurement;
+    rclcpp_lifecycle::LifecyclePublisher<nav_msgs::msg::Odometry, Alloc>::SharedPtr pubFilteredOdometry;
+    rclcpp_lifecycle::LifecyclePublisher<nav_msgs::msg::Odometry, Alloc>::SharedPtr pubIndLiDARMeasurement;
+    rclcpp_lifecycle::LifecyclePublisher<adaptive_filter::msg::FilterState, Alloc>::SharedPtr pubFilterState;
+    rclcpp_lifecycle::LifecyclePublisher<adaptive_filter::msg::SensorHealth, Alloc>::SharedPtr pubSensorHealth;
+    rclcpp_lifecycle::LifecyclePublisher<adaptive_filter::msg::StepOverrun, Alloc>::SharedPtr pubStepOverrun;
+    rclcpp_lifecycle::LifecyclePublisher<adaptive_filter::msg::FilterConsistency, Alloc>::SharedPtr pubConsistency;
 
     // header
     std_msgs::msg::Header headerI;
     std_msgs::msg::Header headerW;
     std_msgs::msg::Header headerL;
 
+    // Service
+    rclcpp::Service<adaptive_filter::srv::GetFilterPose>::SharedPtr srvFilterPose;
+
+    // Pose history
+    std::unique_ptr<PoseHistory> poseHistory;
+
+    // Shared-memory state for same-host consumers
+    SharedStateWriter sharedState;
+
     // TF 
     geometry_msgs::msg::TransformStamped filteredOdometryTrans;
     std::shared_ptr<tf2_ros::TransformBroadcaster> tfBroadcasterfiltered;
@@ -58,21 +281,166 @@ private:
     // filtered odom
     nav_msgs::msg::Odometry filteredOdometry;
     nav_msgs::msg::Odometry indLiDAROdometry;
+    adaptive_filter::msg::FilterState filterState;
+    adaptive_filter::msg::SensorHealth sensorHealth;
+    adaptive_filter::msg::StepOverrun stepOverrun;
+    adaptive_filter::msg::FilterConsistency filterConsistency;
+
+    // Input monitors, updated by the handlers
+    SensorMonitor imuMonitor;
+    SensorMonitor wheelMonitor;
+    SensorMonitor lidarMonitor;
+
+    // NIS of the corrections, updated by the correction stages
+    NisMonitor imuConsistency;
+    NisMonitor wheelConsistency;
+    NisMonitor lidarConsistency;
+
+    // Load of the filter step and the resulting mode
+    OverloadPolicy overload;
+    LoadMode loadMode;
+    int imuStepIntake;   // IMU samples expected per step, not backlog
+    std::chrono::steady_clock::time_point stepRelease;   // scheduled start of the step
+
+    // Deadline of the filter step, per stage
+    DeadlineMonitor deadline;
+
+    // Hardware counters per filter stage (profileRate)
+    StageProfiler profiler;
+
+    // Sensor clocks with respect to the host clock (timeSync)
+    ClockSync imuClock;
+    ClockSync wheelClock;
+    ClockSync lidarClock;
+
+    // Debug outputs, published by a low-priority thread from a one-slot mailbox
+    struct IndirectLidarSample {
+        builtin_interfaces::msg::Time stamp;
+        uint64_t seq;
+        Vector6d y;
+        Matrix6d Q;
+    } debugSample;
+    static const int N_SENSORS = 3;   // imu, wheel, lidar
+    SensorSummary healthSummary[N_SENSORS];
+    double healthClock[N_SENSORS][2];   // offset [s], drift [s/s]
+    NisSummary healthNis[N_SENSORS];
+    int8_t nisVerdict[N_SENSORS];       // debug thread
+    struct LoadReport {
+        LoadMode mode;
+        double load;
+        double slack;
+        size_t backlog;
+    } healthLoad, loadChange;
+    bool loadChangePending;
+    // measurements applied by a correction and lost before one (IMU queue
+    // full, wheel/LiDAR slot overwritten), since activation
+    struct InputCounts {
+        uint64_t processed;
+        uint64_t queueFull;
+        uint64_t overwritten;
+    } inputCounts[N_SENSORS], healthCounts[N_SENSORS];
+    DeadlineSummary healthDeadline;
+    StepOverrun overrunLast;
+    double overrunStamp;
+    uint32_t overrunCount;   // since the debug thread took the last one
+    StepOverrun overrunHeld;   // estimator only, not handed over yet
+    double overrunHeldStamp;
+    uint32_t overrunHeldCount;
+    LoadReport loadChangeHeld;
+    bool loadChangeHeldPending;
+    std::function<void(const StepOverrun&)> overrunCallback;
+    StageCounters profileCounters[adaptive_filter::N_PROFILE_STAGES];
+    double profileSpan;
+    bool profilePending;
+    AllocCounters allocTotals;
+    double allocSpan;
+    bool allocPending;
+    AllocCounters allocReported;   // debug thread
+    uint32_t allocReports;
+    double healthStamp;
+    bool healthAlarm[N_SENSORS];
+    std::thread debugThread;
+    // the estimator only try_locks it: on contention the sample is dropped
+    // or held for the next step, it never waits for the debug thread
+    std::mutex debugMtx;
+    std::condition_variable debugCv;
+    bool debugPending;
+    bool healthPending;
+    bool debugStop;
+
+    // Sequence numbers of the trace probes: messages received per sensor
+    // (executor), the message being processed per sensor and the filter step
+    uint64_t receiveSeq[N_SENSORS];
+    uint64_t inputSeq[N_SENSORS];
+    uint64_t stepSeq;
+
+    // Prometheus metrics (metricsEndpoint), the ids are -1 while disabled
+    MetricsRegistry metrics;
+    MetricsServer metricsServer;
+    int metricProcessed[N_SENSORS];
+    int metricInactive[N_SENSORS];
+    int metricTruncated[N_SENSORS];
+    int metricQueueFull;
+    int metricOverwritten[N_SENSORS];
+    int metricSteps;
+    int metricStepTime;
+    int metricStageTime[adaptive_filter::N_STAGES];
+    int metricOverruns[adaptive_filter::N_STAGES];
+    int metricImuQueue;
+    int metricBacklog;
+    int metricLoad;
+    int metricLoadMode;
+
+    // State snapshots, written by the estimator once per cycle and turned
+    // into messages by the publisher thread
+    adaptive_filter::SnapshotBroadcast<StateSnapshot> snapshots;
+    adaptive_filter::TripleBuffer<StateSnapshot> *publisherSnapshot;
+    StateSnapshot snapshot;
+    std::thread publisherThread;
+    std::mutex publisherMtx;
+    std::condition_variable publisherCv;
+    bool publisherPending;
+    bool publisherStop;
+    int outputScale;   // publisher thread only
+
+    // IMU samples received since the last filter step, drained in order
+    static const int IMU_QUEUE = 50;
+    struct ImuSample {
+        builtin_interfaces::msg::Time stamp;
+        double time;   // stamp in host time with timeSync [s]
+        uint64_t seq;
+        Eigen::Quaterniond q;
+        Vector9d y;
+        Matrix9d E;
+    };
+    std::array<ImuSample, IMU_QUEUE> imuQueue;
+    std::array<Eigen::Matrix3d, IMU_QUEUE> imuWeights;
+    int imuQueueHead;
+    int imuQueueCount;
 
     // Measure
-    Eigen::VectorXd imuMeasure, wheelMeasure, lidarMeasure, lidarMeasureL;
+    Vector9d imuMeasure;
+    Eigen::Vector2d wheelMeasure;
+    Vector6d lidarMeasure, lidarMeasureL;
 
     // Measure Covariance
-    Eigen::MatrixXd E_imu, E_wheel, E_lidar, E_lidarL, E_pred;
+    Matrix9d E_imu;
+    Eigen::Matrix2d E_wheel;
+    Matrix6d E_lidar, E_lidarL;
+    Matrix12d E_pred;
 
     // States and covariances
-    Eigen::VectorXd X, V;
-    Eigen::MatrixXd P, PV;
-
-    // pose and velocities
-    Eigen::VectorXd pose, velocities;
+    Vector12d X, V;
+    Matrix12d P, PV;
 
     // Times
+    double t_last;
+    double tfTimeLast;        // publisher thread only, reset with the epoch
+    double compactTimeLast;
+    double healthTimeLast;
+    double profileTimeLast;
+    double allocTimeLast;
+
     double imuTimeLast;
     double wheelTimeLast;
     double lidarTimeLast;
@@ -93,10 +461,10 @@ private:
     } bias_linear_acceleration, bias_angular_velocity;
 
     // number of state or measure vectors
-    int N_STATES = 12;
-    int N_IMU = 9; 
-    int N_WHEEL = 2; 
-    int N_LIDAR = 6;
+    static const int N_STATES = 12;
+    static const int N_IMU = 9; 
+    static const int N_WHEEL = 2; 
+    static const int N_LIDAR = 6;
     
     // boolean
     bool imuActivated;
@@ -113,18 +481,220 @@ private:
     float l_min;
 
 public:
-    AdaptiveFilter(const std::string &node_name) : Node(node_name) {
+    // component constructor, the parameters are read from the node itself
+    explicit AdaptiveFilter(const rclcpp::NodeOptions &options)
+        : AdaptiveFilter("adaptive_filter", options) {}
+
+    AdaptiveFilter(const std::string &node_name, const rclcpp::NodeOptions &options)
+        : LifecycleNode(node_name, options), active(false) {
+        FilterParameters parameters;
+        this->declare_parameter("/ekf_loam/enableFilter", parameters.enableFilter);
+        this->get_parameter("/ekf_loam/enableFilter", parameters.enableFilter);
+
+        filterParameters = get_filter_parameters(this, "/adaptive_filter/", parameters);
+        publisherSnapshot = snapshots.add_reader();
+    }
+
+    // ns prefixes every topic; with a strand, callbacks and the 200 Hz step are
+    // posted to it instead of running in the executor thread
+    AdaptiveFilter(const std::string &node_name, const FilterParameters &parameters, const std::string &ns = "",
+                   std::shared_ptr<WorkStealingPool::Strand> poolStrand = nullptr)
+        : LifecycleNode(node_name, ns), filterParameters(parameters), topicPrefix(ns), active(false), strand(poolStrand) {
+        publisherSnapshot = snapshots.add_reader();
+    }
+
+    ~AdaptiveFilter() {
+        stop_threads();
+    }
+
+    // wait-free access to the latest state for in-process (composed) readers:
+    // call update() and then read_slot() on the returned buffer, nullptr once
+    // all reader slots are taken
+    adaptive_filter::TripleBuffer<StateSnapshot> *snapshot_reader() {
+        return snapshots.add_reader();
+    }
+
+    bool enabled() const { return filterParameters.enableFilter; }
+
+    //------------------
+    // Lifecycle
+    //------------------
+    // all memory, threads and ROS entities are created here, so that
+    // activation only has to reset the state and open the delivery
+    CallbackReturn on_configure(const rclcpp_lifecycle::State &) override {
+        setup(filterParameters, topicPrefix);
+        return CallbackReturn::SUCCESS;
+    }
+
+    CallbackReturn on_activate(const rclcpp_lifecycle::State &) override {
+        dispatch([this] {
+            poseHistory->clear();
+            initialization();
+        });
+
+        pubFilteredOdometry->on_activate();
+        pubIndLiDARMeasurement->on_activate();
+        if (pubFilterState){
+            pubFilterState->on_activate();
+        }
+        if (pubSensorHealth){
+            pubSensorHealth->on_activate();
+        }
+        if (pubStepOverrun){
+            pubStepOverrun->on_activate();
+        }
+        if (pubConsistency){
+            pubConsistency->on_activate();
+        }
+
+        active = true;
+        if (timer){
+            timer->reset();
+        }
+        return CallbackReturn::SUCCESS;
+    }
+
+    CallbackReturn on_deactivate(const rclcpp_lifecycle::State &) override {
+        active = false;
+        if (timer){
+            timer->cancel();
+        }
+
+        pubFilteredOdometry->on_deactivate();
+        pubIndLiDARMeasurement->on_deactivate();
+        if (pubFilterState){
+            pubFilterState->on_deactivate();
+        }
+        if (pubSensorHealth){
+            pubSensorHealth->on_deactivate();
+        }
+        if (pubStepOverrun){
+            pubStepOverrun->on_deactivate();
+        }
+        if (pubConsistency){
+            pubConsistency->on_deactivate();
+        }
+        return CallbackReturn::SUCCESS;
+    }
+
+    CallbackReturn on_cleanup(const rclcpp_lifecycle::State &) override {
+        release();
+        return CallbackReturn::SUCCESS;
+    }
+
+    CallbackReturn on_shutdown(const rclcpp_lifecycle::State &) override {
+        active = false;
+        release();
+        return CallbackReturn::SUCCESS;
+    }
+
+private:
+    void setup(const FilterParameters &parameters, const std::string &ns) {
+        // Parameters
+        enableFilter = parameters.enableFilter;
+        enableImu = parameters.enableImu;
+        enableWheel = parameters.enableWheel;
+        enableLidar = parameters.enableLidar;
+
+        lidarG = parameters.lidarG;
+        wheelG = parameters.wheelG;
+        imuG = parameters.imuG;
+
+        filterFreq = parameters.filterFreq;
+
+        tfRate = parameters.tfRate;
+        tfOnlyWithListeners = parameters.tfOnlyWithListeners;
+        parentFrame = parameters.parentFrame;
+        childFrame = parameters.childFrame;
+
+        outputRate = parameters.outputRate;
+
+        compactRate = parameters.compactRate;
+        compactCovariance = parameters.compactCovariance;
+
+        historySize = parameters.historySize;
+        historyMaxExtrapolation = parameters.historyMaxExtrapolation;
+
+        sharedStateName = parameters.sharedStateName;
+
+        serializedInput = parameters.serializedInput;
+        sensorQos = parameters.sensorQos;
+
+        imuAggregate = parameters.imuAggregate;
+
+        healthRate = parameters.healthRate;
+        rateAlarmRatio = parameters.rateAlarmRatio;
+        imuMonitor.configure(parameters.imuExpectedRate, rateAlarmRatio);
+        wheelMonitor.configure(parameters.wheelExpectedRate, rateAlarmRatio);
+        lidarMonitor.configure(parameters.lidarExpectedRate, rateAlarmRatio);
+
+        timeSync = parameters.timeSync;
+
+        loadShedding = parameters.loadShedding;
+        imuStepIntake = static_cast<int>(std::ceil(std::max(parameters.imuExpectedRate, 0.0)*0.005));
+        overload.configure(0.005, parameters.degradeLoad, parameters.overloadLoad,
+                           std::max(parameters.degradeBacklog, 1), std::max(parameters.overloadBacklog, 1));
+
+        deadline.configure(parameters.stepDeadline > 0 ? parameters.stepDeadline : 0.005);
+        overrunTopic = parameters.overrunTopic;
+
+        imuConsistency.configure(3, parameters.nisConfidence);
+        wheelConsistency.configure(N_WHEEL, parameters.nisConfidence);
+        lidarConsistency.configure(N_LIDAR, parameters.nisConfidence);
+        consistencyTopic = parameters.consistencyTopic;
+
+        register_metrics(parameters.metricsEndpoint);
+
+        profileRate = parameters.profileRate;
+        profiler.disable();
+        if (profileRate > 0 && !profiler.enable()){
+            RCLCPP_WARN(this->get_logger(), "Hardware counters not available (see perf_event_paranoid), profiling disabled.");
+        }
+
+        allocRate = parameters.allocRate;
+        if (allocRate > 0 && !adaptive_filter::alloc_tracking()){
+            RCLCPP_WARN(this->get_logger(), "Allocation tracking not built in (ADAPTIVE_FILTER_ALLOC_TRACKING), allocRate ignored.");
+            allocRate = 0;
+        }
+
+        // Allocator of the incoming and (intra-process) outgoing messages
+        alloc = std::make_shared<Alloc>();
+        rclcpp::SubscriptionOptionsWithAllocator<Alloc> subOptions;
+        subOptions.allocator = alloc;
+        rclcpp::PublisherOptionsWithAllocator<Alloc> pubOptions;
+        pubOptions.allocator = alloc;
+        intraProcess = this->get_node_options().use_intra_process_comms();
+
+        auto imuStrategy = std::make_shared<rclcpp::message_memory_strategy::MessageMemoryStrategy<sensor_msgs::msg::Imu, Alloc>>(alloc);
+        auto odomStrategy = std::make_shared<rclcpp::message_memory_strategy::MessageMemoryStrategy<nav_msgs::msg::Odometry, Alloc>>(alloc);
+
         // Subscriber
-        subImu = this->create_subscription<sensor_msgs::msg::Imu>(
-            "/imu", 50, std::bind(&AdaptiveFilter::imuHandler, this, std::placeholders::_1));
-        subWheelOdometry = this->create_subscription<nav_msgs::msg::Odometry>(
-            "/odom", 5, std::bind(&AdaptiveFilter::wheelOdometryHandler, this, std::placeholders::_1));
-        subLaserOdometry = this->create_subscription<nav_msgs::msg::Odometry>(
-            "/odom_rf2o", 5, std::bind(&AdaptiveFilter::laserOdometryHandler, this, std::placeholders::_1));
+        subImu = subscribe<sensor_msgs::msg::Imu>(ns + "/imu", 50, subOptions, imuStrategy, adaptive_filter::TRACE_IMU,
+                                                  adaptive_filter::parse_imu, &AdaptiveFilter::imuHandler);
+        subWheelOdometry = subscribe<nav_msgs::msg::Odometry>(ns + "/odom", 5, subOptions, odomStrategy, adaptive_filter::TRACE_WHEEL,
+                                                              adaptive_filter::parse_odometry, &AdaptiveFilter::wheelOdometryHandler);
+        subLaserOdometry = subscribe<nav_msgs::msg::Odometry>(ns + "/odom_rf2o", 5, subOptions, odomStrategy, adaptive_filter::TRACE_LIDAR,
+                                                              adaptive_filter::parse_odometry, &AdaptiveFilter::laserOdometryHandler);
         
         // Publisher
-        pubFilteredOdometry = this->create_publisher<nav_msgs::msg::Odometry>("/ekf_loam/filter_odom_to_init", 5);
-        pubIndLiDARMeasurement = this->create_publisher<nav_msgs::msg::Odometry>("/indirect_lidar_measurement", 5);
+        pubFilteredOdometry = this->create_publisher<nav_msgs::msg::Odometry>(ns + "/ekf_loam/filter_odom_to_init", 5, pubOptions);
+        pubIndLiDARMeasurement = this->create_publisher<nav_msgs::msg::Odometry>(ns + "/indirect_lidar_measurement", 5, pubOptions);
+        if (compactRate > 0){
+            pubFilterState = this->create_publisher<adaptive_filter::msg::FilterState>(ns + "/ekf_loam/filter_state", 5, pubOptions);
+        }
+        if (healthRate > 0){
+            pubSensorHealth = this->create_publisher<adaptive_filter::msg::SensorHealth>(ns + "/ekf_loam/sensor_health", 5, pubOptions);
+        }
+        if (consistencyTopic && healthRate > 0){
+            pubConsistency = this->create_publisher<adaptive_filter::msg::FilterConsistency>(ns + "/ekf_loam/consistency", 5, pubOptions);
+        }
+        if (overrunTopic){
+            pubStepOverrun = this->create_publisher<adaptive_filter::msg::StepOverrun>(ns + "/ekf_loam/step_overrun", 5, pubOptions);
+        }
+
+        // Service
+        srvFilterPose = this->create_service<adaptive_filter::srv::GetFilterPose>(ns + "/ekf_loam/get_filter_pose",
+            std::bind(&AdaptiveFilter::filterPoseHandler, this, std::placeholders::_1, std::placeholders::_2));
 
         // TF Broadcaster
         tfBroadcasterfiltered = std::make_shared<tf2_ros::TransformBroadcaster>(this);
@@ -132,32 +702,287 @@ public:
         // Initialization
         allocateMemory();
         initialization();
+
+        start_threads();
+
+        // 200 Hz filter step, driven by the executor (or the pool) so that
+        // the node never blocks and can be composed; started on activate
+        if (enableFilter){
+            timer = this->create_wall_timer(std::chrono::milliseconds(5), [this] { step_event(); });
+            timer->cancel();
+        }
+    }
+
+    // Typed subscription, or with serializedInput a subscription to the raw CDR
+    // buffer from which only the fields of RecordT are decoded
+    template <typename MessageT, typename RecordT, typename StrategyT>
+    typename rclcpp::Subscription<MessageT, Alloc>::SharedPtr subscribe(const std::string &topic, size_t depth,
+            const rclcpp::SubscriptionOptionsWithAllocator<Alloc> &options, std::shared_ptr<StrategyT> strategy, int sensor,
+            bool (*parse)(const uint8_t*, size_t, RecordT&), void (AdaptiveFilter::*handler)(const RecordT&)) {
+        rclcpp::QoS qos(depth);
+        if (sensorQos == "best_effort"){
+            qos.best_effort();
+        }
+
+        if (serializedInput){
+            return this->create_subscription<MessageT>(
+                topic, qos, [this, topic, sensor, parse, handler](const std::shared_ptr<rclcpp::SerializedMessage> msg) {
+                    if (!active){
+                        metrics.add(metricInactive[sensor]);
+                        return;
+                    }
+                    RecordT record;
+                    const auto &buffer = msg->get_rcl_serialized_message();
+                    if (!parse(buffer.buffer, buffer.buffer_length, record)){
+                        metrics.add(metricTruncated[sensor]);
+                        RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 1000, "Dropped a truncated message on %s.", topic.c_str());
+                        return;
+                    }
+                    deliver(sensor, handler, record);
+                }, options);
+        }
+
+        return this->create_subscription<MessageT>(
+            topic, qos, [this, sensor, handler](const typename MessageT::SharedPtr msg) {
+                if (!active){
+                    metrics.add(metricInactive[sensor]);
+                    return;
+                }
+                RecordT record;
+                to_measurement(*msg, record);
+                deliver(sensor, handler, record);
+            }, options, strategy);
+    }
+
+    // the 200 Hz timer event
+    void step_event() {
+        ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_STEP);
+        dispatch([this] { filter_step(); });
+    }
+
+    // numbers a received message and hands it to its handler; tagged on both
+    // sides of the strand, so that posting is charged to the callback too
+    template <typename RecordT>
+    void deliver(int sensor, void (AdaptiveFilter::*handler)(const RecordT&), const RecordT &record) {
+        ADAPTIVE_FILTER_ALLOC_SCOPE(static_cast<adaptive_filter::AllocTag>(adaptive_filter::ALLOC_IMU_CALLBACK + sensor));
+        uint64_t seq = ++receiveSeq[sensor];
+        ADAPTIVE_FILTER_PROBE3(receive, sensor, seq, static_cast<int64_t>(record.stamp * 1e9));
+        dispatch([this, sensor, seq, handler, record] {
+            ADAPTIVE_FILTER_ALLOC_SCOPE(static_cast<adaptive_filter::AllocTag>(adaptive_filter::ALLOC_IMU_CALLBACK + sensor));
+            inputSeq[sensor] = seq;
+            (this->*handler)(record);
+        });
+    }
+
+    // series of the metrics and the endpoint; before the subscriptions, so
+    // that no callback updates them meanwhile
+    void register_metrics(const std::string &endpoint) {
+        metricsServer.stop();
+        metrics.clear();
+
+        bool on = !endpoint.empty();
+        static const char *sensors[N_SENSORS] = {"imu", "wheel", "lidar"};
+        static const char *stages[adaptive_filter::N_STAGES] = {"prediction", "imu", "wheel", "lidar", "publish"};
+        const std::vector<double> seconds = {1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2};
+
+        for (int i = 0; i < N_SENSORS; i++){
+            std::string label = std::string("sensor=\"") + sensors[i] + "\"";
+            metricProcessed[i] = on ? metrics.counter("adaptive_filter_measurements_total", "Measurements processed by the filter.", label) : -1;
+        }
+        for (int i = 0; i < N_SENSORS; i++){
+            std::string label = std::string("sensor=\"") + sensors[i] + "\"";
+            metricInactive[i] = on ? metrics.counter("adaptive_filter_measurements_rejected_total", "Measurements not processed.", label + ",reason=\"inactive\"") : -1;
+            metricTruncated[i] = on ? metrics.counter("adaptive_filter_measurements_rejected_total", "Measurements not processed.", label + ",reason=\"truncated\"") : -1;
+        }
+        metricQueueFull = on ? metrics.counter("adaptive_filter_measurements_rejected_total", "Measurements not processed.", "sensor=\"imu\",reason=\"queue_full\"") : -1;
+        metricOverwritten[0] = -1;
+        for (int i = 1; i < N_SENSORS; i++){
+            std::string label = std::string("sensor=\"") + sensors[i] + "\",reason=\"overwritten\"";
+            metricOverwritten[i] = on ? metrics.counter("adaptive_filter_measurements_rejected_total", "Measurements not processed.", label) : -1;
+        }
+
+        metricSteps = on ? metrics.counter("adaptive_filter_steps_total", "Filter steps.") : -1;
+        for (int i = 0; i < adaptive_filter::N_STAGES; i++){
+            metricOverruns[i] = on ? metrics.counter("adaptive_filter_overruns_total", "Steps over stepDeadline, by longest stage.", std::string("stage=\"") + stages[i] + "\"") : -1;
+        }
+        metricStepTime = on ? metrics.histogram("adaptive_filter_step_seconds", "Duration of the filter steps.", "", seconds) : -1;
+        for (int i = 0; i < adaptive_filter::N_STAGES; i++){
+            metricStageTime[i] = on ? metrics.histogram("adaptive_filter_stage_seconds", "Time of the stages run in a step.", std::string("stage=\"") + stages[i] + "\"", seconds) : -1;
+        }
+
+        metricImuQueue = on ? metrics.gauge("adaptive_filter_imu_queue_depth", "IMU samples queued at the step start.") : -1;
+        metricBacklog = on ? metrics.gauge("adaptive_filter_backlog", "Events waiting for the filter at the step start, beyond one step of IMU intake.") : -1;
+        metricLoad = on ? metrics.gauge("adaptive_filter_load", "Smoothed share of the step used.") : -1;
+        metricLoadMode = on ? metrics.gauge("adaptive_filter_load_mode", "Load mode (0 normal, 1 degraded, 2 overloaded).") : -1;
+
+        if (on && !metricsServer.start(metrics, endpoint)){
+            RCLCPP_WARN(this->get_logger(), "Could not serve the metrics on %s.", endpoint.c_str());
+        }
+    }
+
+    // undoes setup()
+    void release() {
+        timer.reset();
+        stop_threads();
+
+        subImu.reset();
+        subWheelOdometry.reset();
+        subLaserOdometry.reset();
+
+        pubFilteredOdometry.reset();
+        pubIndLiDARMeasurement.reset();
+        pubFilterState.reset();
+        pubSensorHealth.reset();
+        pubStepOverrun.reset();
+        pubConsistency.reset();
+
+        srvFilterPose.reset();
+        tfBroadcasterfiltered.reset();
+
+        sharedState.close();
+        metricsServer.stop();
+    }
+
+    void start_threads() {
+        // Debug publisher thread
+        debugPending = false;
+        healthPending = false;
+        loadChangePending = false;
+        loadChangeHeldPending = false;
+        overrunCount = 0;
+        overrunHeldCount = 0;
+        profilePending = false;
+        allocPending = false;
+        allocReports = 0;
+        adaptive_filter::alloc_counters(allocReported);
+        debugStop = false;
+        for (int i = 0; i < N_SENSORS; i++){
+            healthAlarm[i] = false;
+            nisVerdict[i] = adaptive_filter::msg::NisStatus::CONSISTENT;
+            receiveSeq[i] = 0;
+            inputSeq[i] = 0;
+        }
+        debugThread = std::thread(&AdaptiveFilter::debug_publisher, this);
+
+        // Publisher thread
+        publisherPending = false;
+        publisherStop = false;
+        publisherThread = std::thread(&AdaptiveFilter::state_publisher, this);
+    }
+
+    void stop_threads() {
+        if (debugThread.joinable()){
+            {
+                std::lock_guard<std::mutex> lock(debugMtx);
+                debugStop = true;
+            }
+            debugCv.notify_one();
+            debugThread.join();
+        }
+
+        if (publisherThread.joinable()){
+            {
+                std::lock_guard<std::mutex> lock(publisherMtx);
+                publisherStop = true;
+            }
+            publisherCv.notify_one();
+            publisherThread.join();
+        }
+    }
+
+public:
+    // called on the debug thread with the latest overrun, at most once per
+    // wake-up (overruns in between are coalesced); set before configure
+    void set_overrun_callback(std::function<void(const StepOverrun&)> callback) {
+        overrunCallback = std::move(callback);
+    }
+
+    // runs a filter event inline or on the filter's strand; the event is
+    // dropped when the strand's ring is full
+    template <typename Task>
+    void dispatch(Task &&task) {
+        if (strand){
+            if (!strand->post(std::forward<Task>(task))){
+                RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 1000, "Filter strand full, events dropped.");
+            }
+        } else {
+            task();
+        }
     }
 
     //------------------
     // Auxliar functions
     //------------------
     void allocateMemory() {
-        imuMeasure.resize(N_IMU);
-        wheelMeasure.resize(N_WHEEL);
-        lidarMeasure.resize(N_LIDAR);
-        lidarMeasureL.resize(N_LIDAR);
+        poseHistory.reset(new PoseHistory(std::max(historySize, 2), historyMaxExtrapolation));
+
+        if (!sharedStateName.empty() && !sharedState.open(sharedStateName)){
+            RCLCPP_WARN(this->get_logger(), "Could not create the shared-memory state %s (in use by another filter?).", sharedStateName.c_str());
+        }
+
+        // states and measures are fixed-size, only the outgoing messages are
+        // prepared here so that publishing never touches their strings
+        filteredOdometry.header.frame_id = parentFrame;
+        filteredOdometry.child_frame_id = childFrame;
+
+        indLiDAROdometry.header.frame_id = parentFrame;
+        indLiDAROdometry.child_frame_id = "ind_lidar_frame";
+
+        filteredOdometryTrans.header.frame_id = parentFrame;
+        filteredOdometryTrans.child_frame_id = childFrame;
+
+        filterState.seq = 0;
+        snapshot.odomSeq = 0;
+        snapshot.epoch = 0;
+        if (compactCovariance == "triangular"){
+            filterState.covariance_type = adaptive_filter::msg::FilterState::TRIANGULAR;
+            filterState.covariance.resize(N_STATES*(N_STATES + 1)/2);
+        } else {
+            filterState.covariance_type = adaptive_filter::msg::FilterState::DIAGONAL;
+            filterState.covariance.resize(N_STATES);
+        }
 
-        E_imu.resize(N_IMU,N_IMU);
-        E_wheel.resize(N_WHEEL,N_WHEEL);
-        E_lidar.resize(N_LIDAR,N_LIDAR);
-        E_lidarL.resize(N_LIDAR,N_LIDAR);
-        E_pred.resize(N_STATES,N_STATES);
+        sensorHealth.sensors.resize(N_SENSORS);
+        sensorHealth.sensors[0].name = "imu";
+        sensorHealth.sensors[1].name = "wheel";
+        sensorHealth.sensors[2].name = "lidar";
 
-        X.resize(N_STATES);
-        P.resize(N_STATES,N_STATES);
+        filterConsistency.sensors.resize(N_SENSORS);
+        for (int i = 0; i < N_SENSORS; i++){
+            filterConsistency.sensors[i].name = sensorHealth.sensors[i].name;
+        }
 
-        V.resize(N_STATES);
-        PV.resize(N_STATES,N_STATES);
+        stepOverrun.total = 0;
     }
 
     void initialization() {
         // times
+        t_last = this->get_clock()->now().seconds();
+        snapshot.epoch++;   // the publisher thread resets its output times
+        healthTimeLast = t_last;
+        profileTimeLast = t_last;
+        allocTimeLast = t_last;
+        profiler.reset();
+
+        imuMonitor.reset(t_last);
+        wheelMonitor.reset(t_last);
+        lidarMonitor.reset(t_last);
+        std::fill(inputCounts, inputCounts + N_SENSORS, InputCounts());
+
+        imuConsistency.reset();
+        wheelConsistency.reset();
+        lidarConsistency.reset();
+
+        imuClock.reset();
+        wheelClock.reset();
+        lidarClock.reset();
+
+        overload.reset();
+        loadMode = adaptive_filter::NORMAL;
+        stepRelease = std::chrono::steady_clock::now();
+        deadline.reset();
+        stepSeq = 0;
+
         imuTimeLast = 0;
         lidarTimeLast = 0;
         wheelTimeLast = 0;
@@ -186,25 +1011,27 @@ public:
         imuNew = false;
         wheelNew = false;
         lidarNew = false;
+        imuQueueHead = 0;
+        imuQueueCount = 0;
 
         velComp = false;
 
         // matrices and vectors
-        imuMeasure = Eigen::VectorXd::Zero(N_IMU);
-        wheelMeasure = Eigen::VectorXd::Zero(N_WHEEL);
-        lidarMeasure = Eigen::VectorXd::Zero(N_LIDAR);
-        lidarMeasureL = Eigen::VectorXd::Zero(N_LIDAR);
+        imuMeasure.setZero();
+        wheelMeasure.setZero();
+        lidarMeasure.setZero();
+        lidarMeasureL.setZero();
         
-        E_imu = Eigen::MatrixXd::Zero(N_IMU,N_IMU);
-        E_lidar = Eigen::MatrixXd::Zero(N_LIDAR,N_LIDAR);
-        E_lidarL = Eigen::MatrixXd::Zero(N_LIDAR,N_LIDAR);
-        E_wheel = Eigen::MatrixXd::Zero(N_WHEEL,N_WHEEL);
-        E_pred = Eigen::MatrixXd::Zero(N_STATES,N_STATES);
+        E_imu.setZero();
+        E_lidar.setZero();
+        E_lidarL.setZero();
+        E_wheel.setZero();
+        E_pred.setZero();
 
         // state initial
-        X = Eigen::VectorXd::Zero(N_STATES);
-        P = Eigen::MatrixXd::Zero(N_STATES,N_STATES);
-        V = Eigen::VectorXd::Zero(N_STATES);
+        X.setZero();
+        P.setZero();
+        V.setZero();
 
         // covariance initial
         P(0,0) = 0.1;   // x
@@ -237,8 +1064,8 @@ public:
         l_min = 0.005;
     }
 
-    MatrixXd adaptive_covariance(double fCorner, double fSurf) {
-        Eigen::MatrixXd Q(6,6);
+    Matrix6d adaptive_covariance(double fCorner, double fSurf) {
+        Matrix6d Q;
         double cov_x, cov_y, cov_z, cov_phi, cov_psi, cov_theta;
         
         // heuristic
@@ -249,7 +1076,7 @@ public:
         cov_phi   = (nSurf - min(fSurf,nSurf))/nSurf + l_min;
         cov_theta   = (nSurf - min(fSurf,nSurf))/nSurf + l_min;
         
-        Q = MatrixXd::Zero(6,6);
+        Q.setZero();
         float b = lidarG/1.0;
         float c = lidarG/1.0;
         Q(0,0) = b*Gx*cov_x;
@@ -265,25 +1092,49 @@ public:
     //-----------------
     // predict function
     //-----------------
-    void prediction_stage(double dt) {
-        Eigen::MatrixXd F(N_STATES,N_STATES);
+    // noise: share of the step's process noise E_pred added by this prediction
+    void prediction_stage(double dt, double noise = 1.0) {
+        StageProfiler::Scope profile(profiler, adaptive_filter::PROFILE_PREDICTION);
+        ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_PREDICTION);
+        Matrix12d F;
 
         // jacobian's computation
-        F = jacobian_state(X, dt);
+        {
+            StageProfiler::Scope profileJacobian(profiler, adaptive_filter::PROFILE_JACOBIAN);
+            F = jacobian_state(X, dt);
+        }
 
         // Priori state and covariance estimated
         X = f_prediction_model(X, dt);
 
         // Priori covariance
-        P = F*P*F.transpose() + E_pred;
+        P = F*P*F.transpose() + noise*E_pred;
     }
 
     //-----------------
     // correction stage
     //-----------------
+    // Kalman's gain P H' S^-1 from the Cholesky factor of S, which also gives
+    // the NIS r' S^-1 r of the innovation; with S not positive definite the
+    // gain falls back to the inverse and no NIS is recorded
+    template <int M>
+    Eigen::Matrix<double, N_STATES, M> kalman_gain(const Eigen::Matrix<double, M, N_STATES> &H, const Eigen::Matrix<double, M, M> &S,
+                                                   const Eigen::Matrix<double, M, 1> &r, NisMonitor &nis) {
+        Eigen::LLT<Eigen::Matrix<double, M, M>> llt(S);
+        if (llt.info() != Eigen::Success){
+            return P*H.transpose()*S.inverse();
+        }
+        nis.sample(llt.matrixL().solve(r).squaredNorm());
+        return llt.solve(H*P).transpose();
+    }
+
     void correction_wheel_stage(double dt) {
-        Eigen::VectorXd Y(N_WHEEL), hx(N_WHEEL);
-        Eigen::MatrixXd H(N_WHEEL,N_STATES), K(N_STATES,N_WHEEL), E(N_WHEEL,N_WHEEL), S(N_WHEEL,N_WHEEL);
+        StageProfiler::Scope profile(profiler, adaptive_filter::PROFILE_WHEEL);
+        ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_WHEEL);
+        Eigen::Vector2d Y, hx;
+        Eigen::Matrix<double, N_WHEEL, N_STATES> H;
+        Eigen::Matrix<double, N_STATES, N_WHEEL> K;
+        Eigen::Matrix2d E, S;
 
         // measure model of wheel odometry (only foward linear velocity)
         hx(0) = X(6);
@@ -292,7 +1143,7 @@ public:
         Y = wheelMeasure;
 
         // Jacobian of hx with respect to the states
-        H = Eigen::MatrixXd::Zero(N_WHEEL,N_STATES);
+        H.setZero();
         H(0,6) = 1; 
         H(1,11) = 1;
 
@@ -301,7 +1152,7 @@ public:
 
         // Kalman's gain
         S = H*P*H.transpose() + E;
-        K = P*H.transpose()*S.inverse();
+        K = kalman_gain<N_WHEEL>(H, S, Y - hx, wheelConsistency);
 
         // correction
         X = X + K*(Y - hx);
@@ -309,9 +1160,12 @@ public:
     }
 
     void correction_imu_stage(double dt) {
+        StageProfiler::Scope profile(profiler, adaptive_filter::PROFILE_IMU);
+        ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_IMU);
         Eigen::Matrix3d S, E;
         Eigen::Vector3d Y, hx;
-        Eigen::MatrixXd H(3,N_STATES), K(N_STATES,3);
+        Eigen::Matrix<double, 3, N_STATES> H;
+        Eigen::Matrix<double, N_STATES, 3> K;
 
         // measure model
         hx = X.block(3,0,3,1);
@@ -319,25 +1173,107 @@ public:
         Y = imuMeasure.block(6,0,3,1);
 
         // Jacobian of hx with respect to the states
-        H = Eigen::MatrixXd::Zero(3,N_STATES);
-        H.block(0,3,3,3) = Eigen::MatrixXd::Identity(3,3);
+        H.setZero();
+        H.block(0,3,3,3).setIdentity();
 
         // covariance matrices
         E = E_imu.block(6,6,3,3);
 
         // Kalman's gain
         S = H*P*H.transpose() + E;
-        K = P*H.transpose()*S.inverse();
+        K = kalman_gain<3>(H, S, Y - hx, imuConsistency);
 
         // correction
         X = X + K*(Y - hx);
         P = P - K*H*P;
     }
 
+    const ImuSample &imu_sample(int i) const {
+        return imuQueue[(imuQueueHead + i) % IMU_QUEUE];
+    }
+
+    // One measurement standing in for the queued IMU samples: information-
+    // weighted means (the orientation averaged on the manifold, then turned
+    // into roll/pitch/yaw) with the fused covariance, equal weights when a
+    // covariance is singular. It approximates the sequential updates only:
+    // no prediction runs between the samples and the angles are not linear
+    // in the quaternion, so it is meant for short queues.
+    void aggregate_imu() {
+        int n = imuQueueCount;
+        const ImuSample &last = imu_sample(n - 1);
+
+        for (int b = 0; b < N_IMU; b += 3){
+            // weights W_i = (sum I_j)^-1 I_i
+            Eigen::Matrix3d infoSum = Eigen::Matrix3d::Zero();
+            bool informative = true;
+            for (int i = 0; i < n && informative; i++){
+                Eigen::LLT<Eigen::Matrix3d> llt(imu_sample(i).E.block<3,3>(b,b));
+                informative = llt.info() == Eigen::Success;
+                if (informative){
+                    imuWeights[i] = llt.solve(Eigen::Matrix3d::Identity());
+                    infoSum += imuWeights[i];
+                }
+            }
+
+            Eigen::Matrix3d E;
+            if (informative){
+                E = infoSum.inverse();
+                for (int i = 0; i < n; i++){
+                    imuWeights[i] = E*imuWeights[i];
+                }
+            } else {
+                E.setZero();
+                for (int i = 0; i < n; i++){
+                    E += imu_sample(i).E.block<3,3>(b,b);
+                    imuWeights[i] = Eigen::Matrix3d::Identity()/n;
+                }
+                E /= n*n;
+            }
+            E_imu.block<3,3>(b,b) = E;
+
+            if (b < 6){
+                Eigen::Vector3d y = Eigen::Vector3d::Zero();
+                for (int i = 0; i < n; i++){
+                    y += imuWeights[i]*imu_sample(i).y.segment<3>(b);
+                }
+                imuMeasure.segment<3>(b) = y;
+            } else {
+                // orientation: weighted mean of the rotation vectors around the
+                // current mean, a few iterations from the newest sample
+                Eigen::Quaterniond q = last.q;
+                for (int it = 0; it < 3; it++){
+                    Eigen::Vector3d delta = Eigen::Vector3d::Zero();
+                    for (int i = 0; i < n; i++){
+                        Eigen::Quaterniond d = q.conjugate()*imu_sample(i).q;
+                        if (d.w() < 0){
+                            d.coeffs() *= -1;
+                        }
+                        Eigen::AngleAxisd aa(d);
+                        delta += imuWeights[i]*(aa.angle()*aa.axis());
+                    }
+                    double angle = delta.norm();
+                    if (angle < 1e-12){
+                        break;
+                    }
+                    q = (q*Eigen::Quaterniond(Eigen::AngleAxisd(angle, delta/angle))).normalized();
+                }
+
+                double roll, pitch, yaw;
+                tf2::Matrix3x3(tf2::Quaternion(q.x(), q.y(), q.z(), q.w())).getRPY(roll, pitch, yaw);
+                imuMeasure.segment<3>(6) << roll, pitch, yaw;
+            }
+        }
+
+        headerI.stamp = last.stamp;
+    }
+
     void correction_lidar_stage(double dt) {
-        Eigen::MatrixXd K(N_STATES,N_LIDAR), S(N_LIDAR,N_LIDAR), G(N_LIDAR,N_LIDAR), Gl(N_LIDAR,N_LIDAR), Q(N_LIDAR,N_LIDAR);
-        Eigen::VectorXd Y(N_LIDAR), hx(N_LIDAR);
-        Eigen::MatrixXd H(N_LIDAR,N_STATES); 
+        StageProfiler::Scope profile(profiler, adaptive_filter::PROFILE_LIDAR);
+        ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_LIDAR);
+        Eigen::Matrix<double, N_STATES, N_LIDAR> K;
+        Matrix6d S, G, Gl, Q;
+        Vector6d Y, hx;
+        Eigen::Matrix<double, N_LIDAR, N_STATES> H;
 
         // measure model
         hx = X.block(6,0,6,1);
@@ -345,8 +1281,8 @@ public:
         Y = indirect_lidar_measurement(lidarMeasure, lidarMeasureL, dt);
 
         // Jacobian of hx with respect to the states
-        H = Eigen::MatrixXd::Zero(N_LIDAR,N_STATES);
-        H.block(0,6,6,6) = Eigen::MatrixXd::Identity(N_LIDAR,N_LIDAR);
+        H.setZero();
+        H.block(0,6,6,6).setIdentity();
 
         // Error propagation
         G = jacobian_lidar_measurement(lidarMeasure, lidarMeasureL, dt);
@@ -354,12 +1290,12 @@ public:
 
         Q =  G*E_lidar*G.transpose() + Gl*E_lidarL*Gl.transpose();
 
-        // data save 
+        // data save (handed to the debug thread)
         publish_indirect_lidar_measurement(Y, Q);        
 
         // Kalman's gain
         S = H*P*H.transpose() + Q;
-        K = P*H.transpose()*S.inverse();
+        K = kalman_gain<N_LIDAR>(H, S, Y - hx, lidarConsistency);
 
         // correction
         X = X + K*(Y - hx);
@@ -373,12 +1309,12 @@ public:
     //---------
     // Models
     //---------
-    VectorXd f_prediction_model(VectorXd x, double dt) { 
+    Vector12d f_prediction_model(const Vector12d &x, double dt) { 
         // state: {x, y, z, roll, pitch, yaw, vx, vy, vz, wx, wy, wz}
         //        {         (world)         }{        (body)        }
         Eigen::Matrix3d R, Rx, Ry, Rz, J;
-        Eigen::VectorXd xp(N_STATES);
-        Eigen::MatrixXd A(6,6);    
+        Vector12d xp;
+        Matrix6d A;
 
         // Rotation matrix
         Rx = Eigen::AngleAxisd(x(3), Eigen::Vector3d::UnitX());
@@ -392,7 +1328,7 @@ public:
              0.0, sin(x(3))/cos(x(4)), cos(x(3))/cos(x(4));
         
         // model
-        A = Eigen::MatrixXd::Identity(6,6);
+        A.setIdentity();
         A.block(0,0,3,3) = R;
         A.block(3,3,3,3) = J;
 
@@ -402,10 +1338,10 @@ public:
         return xp;
     }
 
-    VectorXd indirect_lidar_measurement(VectorXd u, VectorXd ul, double dt) {
+    Vector6d indirect_lidar_measurement(const Vector6d &u, const Vector6d &ul, double dt) {
         Eigen::Matrix3d R, Rx, Ry, Rz, J;
-        Eigen::VectorXd up(N_LIDAR), u_diff(N_LIDAR);  
-        Eigen::MatrixXd A(N_LIDAR,N_LIDAR);  
+        Vector6d up, u_diff;
+        Matrix6d A;
 
         // Rotation matrix
         Rx = Eigen::AngleAxisd(ul(3), Eigen::Vector3d::UnitX());
@@ -424,7 +1360,7 @@ public:
         u_diff(4) = atan2(sin(u(4) - ul(4)),cos(u(4) - ul(4)));
         u_diff(5) = atan2(sin(u(5) - ul(5)),cos(u(5) - ul(5)));
 
-        A = Eigen::MatrixXd::Zero(N_LIDAR,N_LIDAR);
+        A.setZero();
         A.block(0,0,3,3) = R.transpose();
         A.block(3,3,3,3) = J.inverse();
 
@@ -437,14 +1373,14 @@ public:
     //----------
     // Jacobians
     //----------
-    MatrixXd jacobian_state(VectorXd x, double dt) {
-        Eigen::MatrixXd J(N_STATES,N_STATES);
-        Eigen::VectorXd f0(N_STATES), f1(N_STATES), x_plus(N_STATES);
+    Matrix12d jacobian_state(const Vector12d &x, double dt) {
+        Matrix12d J;
+        Vector12d f0, f1, x_plus;
 
         f0 = f_prediction_model(x, dt);
 
         double delta = 0.0001;
-        for (size_t i = 0; i < N_STATES; i++){
+        for (int i = 0; i < N_STATES; i++){
             x_plus = x;
             x_plus(i) = x_plus(i) + delta;
 
@@ -459,14 +1395,14 @@ public:
         return J;
     }
 
-    MatrixXd jacobian_lidar_measurement(VectorXd u, VectorXd ul, double dt) { 
-        Eigen::MatrixXd J(N_LIDAR,N_LIDAR);
-        Eigen::VectorXd f0(N_LIDAR), f1(N_LIDAR), u_plus(N_LIDAR);
+    Matrix6d jacobian_lidar_measurement(const Vector6d &u, const Vector6d &ul, double dt) { 
+        Matrix6d J;
+        Vector6d f0, f1, u_plus;
 
         f0 = indirect_lidar_measurement(u, ul, dt);
 
         double delta = 0.0000001;
-        for (size_t i = 0; i < N_LIDAR; i++){
+        for (int i = 0; i < N_LIDAR; i++){
             u_plus = u;
             u_plus(i) = u_plus(i) + delta;
 
@@ -481,14 +1417,14 @@ public:
         return J;
     }
 
-    MatrixXd jacobian_lidar_measurementL(VectorXd u, VectorXd ul, double dt) { 
-        Eigen::MatrixXd J(N_LIDAR,N_LIDAR);
-        Eigen::VectorXd f0(N_LIDAR), f1(N_LIDAR), ul_plus(N_LIDAR);
+    Matrix6d jacobian_lidar_measurementL(const Vector6d &u, const Vector6d &ul, double dt) { 
+        Matrix6d J;
+        Vector6d f0, f1, ul_plus;
 
         f0 = indirect_lidar_measurement(u, ul, dt);
 
         double delta = 0.0000001;
-        for (size_t i = 0; i < N_LIDAR; i++){
+        for (int i = 0; i < N_LIDAR; i++){
             ul_plus = ul;
             ul_plus(i) = ul_plus(i) + delta;
 
@@ -506,39 +1442,80 @@ public:
     //----------
     // callbacks
     //----------
-    void imuHandler(const sensor_msgs::msg::Imu::SharedPtr imuIn) {
+    static void to_measurement(const sensor_msgs::msg::Imu &msg, ImuMeasurement &imu) {
+        imu.stamp = msg.header.stamp.sec + msg.header.stamp.nanosec * 1e-9;
+        imu.orientation[0] = msg.orientation.x;
+        imu.orientation[1] = msg.orientation.y;
+        imu.orientation[2] = msg.orientation.z;
+        imu.orientation[3] = msg.orientation.w;
+        imu.angularVelocity[0] = msg.angular_velocity.x;
+        imu.angularVelocity[1] = msg.angular_velocity.y;
+        imu.angularVelocity[2] = msg.angular_velocity.z;
+        imu.linearAcceleration[0] = msg.linear_acceleration.x;
+        imu.linearAcceleration[1] = msg.linear_acceleration.y;
+        imu.linearAcceleration[2] = msg.linear_acceleration.z;
+        for (int i = 0; i < 9; i++){
+            imu.orientationCovariance[i] = msg.orientation_covariance[i];
+            imu.angularVelocityCovariance[i] = msg.angular_velocity_covariance[i];
+            imu.linearAccelerationCovariance[i] = msg.linear_acceleration_covariance[i];
+        }
+    }
+
+    static void to_measurement(const nav_msgs::msg::Odometry &msg, OdometryMeasurement &odom) {
+        odom.stamp = msg.header.stamp.sec + msg.header.stamp.nanosec * 1e-9;
+        odom.position[0] = msg.pose.pose.position.x;
+        odom.position[1] = msg.pose.pose.position.y;
+        odom.position[2] = msg.pose.pose.position.z;
+        odom.orientation[0] = msg.pose.pose.orientation.x;
+        odom.orientation[1] = msg.pose.pose.orientation.y;
+        odom.orientation[2] = msg.pose.pose.orientation.z;
+        odom.orientation[3] = msg.pose.pose.orientation.w;
+        odom.linear[0] = msg.twist.twist.linear.x;
+        odom.linear[1] = msg.twist.twist.linear.y;
+        odom.linear[2] = msg.twist.twist.linear.z;
+        odom.angular[0] = msg.twist.twist.angular.x;
+        odom.angular[1] = msg.twist.twist.angular.y;
+        odom.angular[2] = msg.twist.twist.angular.z;
+        for (int i = 0; i < 36; i++){
+            odom.twistCovariance[i] = msg.twist.covariance[i];
+        }
+    }
+
+    void imuHandler(const ImuMeasurement &imuIn) {
         double timeL = this->get_clock()->now().seconds();
 
+        // stamp in host time
+        double stamp = imuIn.stamp;
+        if (timeSync){
+            imuClock.sample(stamp, timeL);
+            stamp = imuClock.to_host(stamp);
+        }
+
         // time
         if (imuActivated){
             imuTimeLast = imuTimeCurrent;
-            imuTimeCurrent = imuIn->header.stamp.sec + imuIn->header.stamp.nanosec * 1e-9;
+            imuTimeCurrent = stamp;
         } else {
-            imuTimeCurrent = imuIn->header.stamp.sec + imuIn->header.stamp.nanosec * 1e-9;
+            imuTimeCurrent = stamp;
             imuTimeLast = imuTimeCurrent + 0.01;
             imuActivated = true;
         }       
+        imuMonitor.sample(imuTimeCurrent, timeL);
 
         // roll, pitch and yaw 
         double roll, pitch, yaw;
-        geometry_msgs::msg::Quaternion orientation = imuIn->orientation;
-        tf2::Matrix3x3(tf2::Quaternion(orientation.x, orientation.y, orientation.z, orientation.w)).getRPY(roll, pitch, yaw);
+        const double *orientation = imuIn.orientation;
+        tf2::Matrix3x3(tf2::Quaternion(orientation[0], orientation[1], orientation[2], orientation[3])).getRPY(roll, pitch, yaw);
 
         // measure
-        imuMeasure.block(0,0,3,1) << imuIn->linear_acceleration.x, imuIn->linear_acceleration.y, imuIn->linear_acceleration.z;
-        imuMeasure.block(3,0,3,1) << imuIn->angular_velocity.x, imuIn->angular_velocity.y, imuIn->angular_velocity.z; 
+        imuMeasure.block(0,0,3,1) << imuIn.linearAcceleration[0], imuIn.linearAcceleration[1], imuIn.linearAcceleration[2];
+        imuMeasure.block(3,0,3,1) << imuIn.angularVelocity[0], imuIn.angularVelocity[1], imuIn.angularVelocity[2]; 
         imuMeasure.block(6,0,3,1) << roll, pitch, yaw;
 
-        // covariance
-        E_imu.block(0,0,3,3) << imuIn->linear_acceleration_covariance[0], imuIn->linear_acceleration_covariance[1], imuIn->linear_acceleration_covariance[2],
-                                imuIn->linear_acceleration_covariance[3], imuIn->linear_acceleration_covariance[4], imuIn->linear_acceleration_covariance[5],
-                                imuIn->linear_acceleration_covariance[6], imuIn->linear_acceleration_covariance[7], imuIn->linear_acceleration_covariance[8];
-        E_imu.block(3,3,3,3) << imuIn->angular_velocity_covariance[0], imuIn->angular_velocity_covariance[1], imuIn->angular_velocity_covariance[2],
-                                imuIn->angular_velocity_covariance[3], imuIn->angular_velocity_covariance[4], imuIn->angular_velocity_covariance[5],
-                                imuIn->angular_velocity_covariance[6], imuIn->angular_velocity_covariance[7], imuIn->angular_velocity_covariance[8];
-        E_imu.block(6,6,3,3) << imuIn->orientation_covariance[0], imuIn->orientation_covariance[1], imuIn->orientation_covariance[2],
-                                imuIn->orientation_covariance[3], imuIn->orientation_covariance[4], imuIn->orientation_covariance[5],
-                                imuIn->orientation_covariance[6], imuIn->orientation_covariance[7], imuIn->orientation_covariance[8];
+        // covariance (row-major in the message)
+        E_imu.block(0,0,3,3) = Map<const Matrix<double, 3, 3, RowMajor>>(imuIn.linearAccelerationCovariance);
+        E_imu.block(3,3,3,3) = Map<const Matrix<double, 3, 3, RowMajor>>(imuIn.angularVelocityCovariance);
+        E_imu.block(6,6,3,3) = Map<const Matrix<double, 3, 3, RowMajor>>(imuIn.orientationCovariance);
 
         E_imu.block(6,6,3,3) = imuG*E_imu.block(6,6,3,3);
 
@@ -548,31 +1525,54 @@ public:
 
         // header
         double timediff = this->get_clock()->now().seconds() - timeL + imuTimeCurrent;
-        headerI = imuIn->header;
         headerI.stamp = rclcpp::Time(static_cast<int64_t>(timediff * 1e9));
 
+        // queue, the oldest sample is dropped when it is full
+        if (imuQueueCount == IMU_QUEUE){
+            metrics.add(metricQueueFull);
+            inputCounts[adaptive_filter::TRACE_IMU].queueFull++;
+            imuQueueHead = (imuQueueHead + 1) % IMU_QUEUE;
+            imuQueueCount--;
+        }
+        ImuSample &sample = imuQueue[(imuQueueHead + imuQueueCount) % IMU_QUEUE];
+        sample.stamp = headerI.stamp;
+        sample.time = imuTimeCurrent;
+        sample.seq = inputSeq[adaptive_filter::TRACE_IMU];
+        sample.q = Eigen::Quaterniond(orientation[3], orientation[0], orientation[1], orientation[2]).normalized();
+        sample.y = imuMeasure;
+        sample.E = E_imu;
+        imuQueueCount++;
+
         imuNew = true;
     }
 
-    void wheelOdometryHandler(const nav_msgs::msg::Odometry::SharedPtr wheelOdometry) {
+    void wheelOdometryHandler(const OdometryMeasurement &wheelOdometry) {
         double timeL = this->get_clock()->now().seconds();
 
+        // stamp in host time
+        double stamp = wheelOdometry.stamp;
+        if (timeSync){
+            wheelClock.sample(stamp, timeL);
+            stamp = wheelClock.to_host(stamp);
+        }
+
         // time
         if (wheelActivated){
             wheelTimeLast = wheelTimeCurrent;
-            wheelTimeCurrent = wheelOdometry->header.stamp.sec + wheelOdometry->header.stamp.nanosec * 1e-9;
+            wheelTimeCurrent = stamp;
         } else {
-            wheelTimeCurrent = wheelOdometry->header.stamp.sec + wheelOdometry->header.stamp.nanosec * 1e-9;
+            wheelTimeCurrent = stamp;
             wheelTimeLast = wheelTimeCurrent + 0.05;
             wheelActivated = true;
         } 
+        wheelMonitor.sample(wheelTimeCurrent, timeL);
 
         // measure
-        wheelMeasure << 1.0*wheelOdometry->twist.twist.linear.x, wheelOdometry->twist.twist.angular.z;
+        wheelMeasure << 1.0*wheelOdometry.linear[0], wheelOdometry.angular[2];
 
         // covariance
-        E_wheel(0,0) = wheelG*wheelOdometry->twist.covariance[0];
-        E_wheel(1,1) = 100*wheelOdometry->twist.covariance[35];
+        E_wheel(0,0) = wheelG*wheelOdometry.twistCovariance[0];
+        E_wheel(1,1) = 100*wheelOdometry.twistCovariance[35];
 
         // time
         wheel_dt = wheelTimeCurrent - wheelTimeLast;
@@ -580,37 +1580,48 @@ public:
 
         // header
         double timediff = this->get_clock()->now().seconds() - timeL + wheelTimeCurrent;
-        headerW = wheelOdometry->header;
         headerW.stamp = rclcpp::Time(static_cast<int64_t>(timediff * 1e9));
 
 
-        // new measure
+        // new measure, one not applied yet is lost
+        if (wheelNew){
+            metrics.add(metricOverwritten[adaptive_filter::TRACE_WHEEL]);
+            inputCounts[adaptive_filter::TRACE_WHEEL].overwritten++;
+        }
         wheelNew = true;
     }
 
-    void laserOdometryHandler(const nav_msgs::msg::Odometry::SharedPtr laserOdometry) {
+    void laserOdometryHandler(const OdometryMeasurement &laserOdometry) {
         double timeL = this->get_clock()->now().seconds();
 
+        // stamp in host time
+        double stamp = laserOdometry.stamp;
+        if (timeSync){
+            lidarClock.sample(stamp, timeL);
+            stamp = lidarClock.to_host(stamp);
+        }
+
         if (lidarActivated){
             lidarTimeLast = lidarTimeCurrent;
-            lidarTimeCurrent = laserOdometry->header.stamp.sec + laserOdometry->header.stamp.nanosec * 1e-9;
+            lidarTimeCurrent = stamp;
         } else {
-            lidarTimeCurrent = laserOdometry->header.stamp.sec + laserOdometry->header.stamp.nanosec * 1e-9;
+            lidarTimeCurrent = stamp;
             lidarTimeLast = lidarTimeCurrent + 0.1;
             lidarActivated = true;
         }  
+        lidarMonitor.sample(lidarTimeCurrent, timeL);
         
         // roll, pitch and yaw 
         double roll, pitch, yaw;
-        geometry_msgs::msg::Quaternion orientation = laserOdometry->pose.pose.orientation;
-        tf2::Matrix3x3(tf2::Quaternion(orientation.x, orientation.y, orientation.z, orientation.w)).getRPY(roll, pitch, yaw);
+        const double *orientation = laserOdometry.orientation;
+        tf2::Matrix3x3(tf2::Quaternion(orientation[0], orientation[1], orientation[2], orientation[3])).getRPY(roll, pitch, yaw);
 
-        lidarMeasure.block(0,0,3,1) << laserOdometry->pose.pose.position.x, laserOdometry->pose.pose.position.y, laserOdometry->pose.pose.position.z;
+        lidarMeasure.block(0,0,3,1) << laserOdometry.position[0], laserOdometry.position[1], laserOdometry.position[2];
         lidarMeasure.block(3,0,3,1) << roll, pitch, yaw;    
 
         // covariance
-        double corner = double(laserOdometry->twist.twist.linear.x);
-        double surf = double(laserOdometry->twist.twist.angular.x); 
+        double corner = laserOdometry.linear[0];
+        double surf = laserOdometry.angular[0]; 
 
         E_lidar = adaptive_covariance(corner, surf);
 
@@ -620,37 +1631,226 @@ public:
 
         // header
         double timediff = this->get_clock()->now().seconds() - timeL + lidarTimeCurrent;
-        headerL = laserOdometry->header;
         headerL.stamp = rclcpp::Time(static_cast<int64_t>(timediff * 1e9));
 
         
-        //New measure
+        //New measure, one not applied yet is lost
+        if (lidarNew){
+            metrics.add(metricOverwritten[adaptive_filter::TRACE_LIDAR]);
+            inputCounts[adaptive_filter::TRACE_LIDAR].overwritten++;
+        }
         lidarNew = true;
     }
 
+    void filterPoseHandler(const std::shared_ptr<adaptive_filter::srv::GetFilterPose::Request> request,
+                           std::shared_ptr<adaptive_filter::srv::GetFilterPose::Response> response) {
+        PoseHistory::Entry pose;
+        PoseHistory::Result result = pose_at(rclcpp::Time(request->stamp).seconds(), pose);
+
+        response->success = result != PoseHistory::NONE;
+        response->extrapolated = result == PoseHistory::EXTRAPOLATED;
+        response->pose.header.stamp = request->stamp;
+        response->pose.header.frame_id = parentFrame;
+        if (!response->success){
+            return;
+        }
+
+        response->pose.pose.pose.position.x = pose.position.x();
+        response->pose.pose.pose.position.y = pose.position.y();
+        response->pose.pose.pose.position.z = pose.position.z();
+        response->pose.pose.pose.orientation.x = pose.orientation.x();
+        response->pose.pose.pose.orientation.y = pose.orientation.y();
+        response->pose.pose.pose.orientation.z = pose.orientation.z();
+        response->pose.pose.pose.orientation.w = pose.orientation.w();
+
+        for (int i = 0; i < 6; i++){
+            for (int j = 0; j < 6; j++){
+                response->pose.pose.covariance[i*6 + j] = pose.covariance(i,j);
+            }
+        }
+    }
+
+    //--------------
+    // pose history
+    //--------------
+    // pose at an arbitrary stamp [s] for in-process callers (thread-safe)
+    PoseHistory::Result pose_at(double stamp, PoseHistory::Entry &pose) const {
+        return poseHistory->query(stamp, pose);
+    }
+
+    void record_pose(double stamp) {
+        Eigen::Quaterniond q = Eigen::AngleAxisd(X(5), Eigen::Vector3d::UnitZ())
+                             * Eigen::AngleAxisd(X(4), Eigen::Vector3d::UnitY())
+                             * Eigen::AngleAxisd(X(3), Eigen::Vector3d::UnitX());
+        poseHistory->push(stamp, X.head<3>(), q, P.topLeftCorner<6,6>());
+    }
+
     //----------
     // publisher
     //----------
+    // stages the current state as the next odometry output
     void publish_odom(char model) {
         switch(model) {
             case 'i':
-                filteredOdometry.header = headerI;
+                snapshot.odomStamp = rclcpp::Time(headerI.stamp).nanoseconds();
                 break;
             case 'w':
-                filteredOdometry.header = headerW;
+                snapshot.odomStamp = rclcpp::Time(headerW.stamp).nanoseconds();
                 break;
             case 'l':
-                filteredOdometry.header = headerL;
+                snapshot.odomStamp = rclcpp::Time(headerL.stamp).nanoseconds();
+                break;
+            case 'p':
+                snapshot.odomStamp = static_cast<int64_t>(t_last * 1e9);
         }
 
-        filteredOdometry.header.frame_id = "chassis_init";
-        filteredOdometry.child_frame_id = "ekf_odom_frame";
+        snapshot.odomX = X;
+        snapshot.odomP = P;
+        snapshot.odomSeq++;
+    }
+
+    // hands the state of this cycle to the publisher thread
+    void publish_snapshot() {
+        snapshot.stamp = t_last;
+        snapshot.X = X;
+        snapshot.P = P;
+        snapshot.Q = E_pred;
+        snapshot.loadMode = loadMode;
+        snapshot.step = stepSeq;
+        snapshots.write(snapshot);
+
+        {
+            std::lock_guard<std::mutex> lock(publisherMtx);
+            publisherPending = true;
+        }
+        publisherCv.notify_one();
+    }
+
+    void state_publisher() {
+        ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_OUTPUTS);
+        uint64_t odomSeqLast = 0;
+        uint64_t epochLast = 0;
+        bool received = false;
+        outputScale = 1;
+        tfTimeLast = 0;
+        compactTimeLast = 0;
+
+        auto outputPeriod = std::chrono::nanoseconds(outputRate > 0 ? static_cast<int64_t>(1e9/outputRate) : 0);
+        auto outputNext = std::chrono::steady_clock::now() + outputPeriod;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(publisherMtx);
+                if (outputRate > 0){
+                    publisherCv.wait_until(lock, outputNext, [this] { return publisherPending || publisherStop; });
+                } else {
+                    publisherCv.wait(lock, [this] { return publisherPending || publisherStop; });
+                }
+                if (publisherStop) return;
+                publisherPending = false;
+            }
+
+            if (publisherSnapshot->update()){
+                const StateSnapshot &s = publisherSnapshot->read_slot();
+                received = true;
+
+                // output rates are halved while the filter is overloaded
+                outputScale = s.loadMode == adaptive_filter::OVERLOADED ? 2 : 1;
+
+                // the filter was (re)initialized
+                if (s.epoch != epochLast){
+                    epochLast = s.epoch;
+                    tfTimeLast = 0;
+                    compactTimeLast = 0;
+                }
+
+                if (s.odomSeq != odomSeqLast){
+                    odomSeqLast = s.odomSeq;
+                    filteredOdometry.header.stamp = rclcpp::Time(s.odomStamp);
+                    publish_state(s.odomX, s.odomP);
+                    ADAPTIVE_FILTER_PROBE3(publish, adaptive_filter::TRACE_ODOM, s.odomSeq, s.odomStamp);
+                }
 
-        // geometry_msgs::msg::Quaternion geoQuat = tf2::toMsg(tf2::Quaternion(X(3), X(4), X(5)));
+                publish_filter_state(s);
+                broadcast_tf(s);
+            }
+
+            // output at its own rate, independent of the sensors
+            auto now = std::chrono::steady_clock::now();
+            if (outputRate > 0 && now >= outputNext){
+                outputNext += outputScale*outputPeriod;
+                if (outputNext < now){
+                    outputNext = now + outputScale*outputPeriod;
+                }
+                if (received){
+                    publish_output(publisherSnapshot->read_slot());
+                }
+            }
+        }
+    }
+
+    // state extrapolated to the publish instant, from the snapshot only: the
+    // filter state is neither read nor changed
+    void publish_output(const StateSnapshot &s) {
+        if (!has_subscribers(pubFilteredOdometry)){
+            return;
+        }
+
+        double t_now = this->get_clock()->now().seconds();
+        double dt = t_now - s.stamp;
+
+        Matrix12d F = jacobian_state(s.X, dt);
+        Vector12d Xo = f_prediction_model(s.X, dt);
+        Matrix12d Po = F*s.P*F.transpose() + s.Q;
+
+        filteredOdometry.header.stamp = rclcpp::Time(static_cast<int64_t>(t_now * 1e9));
+        publish_state(Xo, Po);
+        ADAPTIVE_FILTER_PROBE3(publish, adaptive_filter::TRACE_OUTPUT, s.step, static_cast<int64_t>(t_now * 1e9));
+    }
+
+    // with intra-process comms the message is copied once into a pooled
+    // unique_ptr and handed over, so composed subscribers take ownership of it
+    // without serialization; otherwise it is published from the member. Only
+    // the middleware calls are left out of the outputs' allocation count
+    // (ALLOC_OTHER), filling in and copying the message is not.
+    template <typename PublisherT, typename MessageT>
+    void publish_message(const std::shared_ptr<PublisherT> &pub, const MessageT &msg) {
+        if (!intraProcess){
+            ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_OTHER);
+            pub->publish(msg);
+            return;
+        }
+
+        typedef rclcpp::allocator::AllocRebind<MessageT, Alloc> MessageAllocTraits;
+        typedef typename MessageAllocTraits::allocator_type MessageAlloc;
+        static MessageAlloc messageAlloc;
+
+        MessageT *ptr = MessageAllocTraits::allocate(messageAlloc, 1);
+        MessageAllocTraits::construct(messageAlloc, ptr, msg);
+
+        rclcpp::allocator::Deleter<MessageAlloc, MessageT> deleter;
+        rclcpp::allocator::set_allocator_for_deleter(&deleter, &messageAlloc);
+        std::unique_ptr<MessageT, rclcpp::allocator::Deleter<MessageAlloc, MessageT>> message(ptr, deleter);
+        ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_OTHER);
+        pub->publish(std::move(message));
+    }
+
+    template <typename PublisherT>
+    static bool has_subscribers(const PublisherT &pub) {
+        ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_OTHER);   // middleware query
+        return pub && (pub->get_subscription_count() > 0 || pub->get_intra_process_subscription_count() > 0);
+    }
+
+    void publish_state(const Vector12d &x, const Matrix12d &p) {
+        if (!has_subscribers(pubFilteredOdometry)){
+            return;
+        }
+
+        // geometry_msgs::msg::Quaternion geoQuat = tf2::toMsg(tf2::Quaternion(x(3), x(4), x(5)));
         
         // Create quaternion from roll, pitch, yaw
         tf2::Quaternion q;
-        q.setRPY(X(3), X(4), X(5));
+        q.setRPY(x(3), x(4), x(5));
         geometry_msgs::msg::Quaternion geoQuat = tf2::toMsg(q);
 
         // pose
@@ -658,43 +1858,430 @@ public:
         filteredOdometry.pose.pose.orientation.y = geoQuat.y;
         filteredOdometry.pose.pose.orientation.z = geoQuat.z;
         filteredOdometry.pose.pose.orientation.w = geoQuat.w;
-        filteredOdometry.pose.pose.position.x = X(0); 
-        filteredOdometry.pose.pose.position.y = X(1);
-        filteredOdometry.pose.pose.position.z = X(2);
+        filteredOdometry.pose.pose.position.x = x(0); 
+        filteredOdometry.pose.pose.position.y = x(1);
+        filteredOdometry.pose.pose.position.z = x(2);
 
         // pose convariance
         int k = 0;
         for (int i = 0; i < 6; i++){
             for (int j = 0; j < 6; j++){
-                filteredOdometry.pose.covariance[k] = P(i,j);
+                filteredOdometry.pose.covariance[k] = p(i,j);
                 k++;
             }
         }      
 
         // twist
-        filteredOdometry.twist.twist.linear.x = X(6);
-        filteredOdometry.twist.twist.linear.y = X(7);
-        filteredOdometry.twist.twist.linear.z = X(8);
-        filteredOdometry.twist.twist.angular.x = X(9);
-        filteredOdometry.twist.twist.angular.y = X(10);
-        filteredOdometry.twist.twist.angular.z = X(11);
+        filteredOdometry.twist.twist.linear.x = x(6);
+        filteredOdometry.twist.twist.linear.y = x(7);
+        filteredOdometry.twist.twist.linear.z = x(8);
+        filteredOdometry.twist.twist.angular.x = x(9);
+        filteredOdometry.twist.twist.angular.y = x(10);
+        filteredOdometry.twist.twist.angular.z = x(11);
 
         // twist convariance
         k = 0;
         for (int i = 6; i < 12; i++){
             for (int j = 6; j < 12; j++){
-                filteredOdometry.twist.covariance[k] = P(i,j);
+                filteredOdometry.twist.covariance[k] = p(i,j);
                 k++;
             }
         } 
 
-        pubFilteredOdometry->publish(filteredOdometry);
+        publish_message(pubFilteredOdometry, filteredOdometry);
     }
 
-    void publish_indirect_lidar_measurement(VectorXd y, MatrixXd Pi) {
-        indLiDAROdometry.header = headerL;
-        indLiDAROdometry.header.frame_id = "chassis_init";
-        indLiDAROdometry.child_frame_id = "ind_lidar_frame";
+    void publish_indirect_lidar_measurement(const Vector6d &y, const Matrix6d &Pi) {
+        if (loadMode != adaptive_filter::NORMAL || !has_subscribers(pubIndLiDARMeasurement)){
+            return;
+        }
+
+        // a sample the thread has not taken yet is overwritten, and one that
+        // finds the thread copying is dropped
+        std::unique_lock<std::mutex> lock(debugMtx, std::try_to_lock);
+        if (!lock.owns_lock()){
+            return;
+        }
+        debugSample.stamp = headerL.stamp;
+        debugSample.seq = inputSeq[adaptive_filter::TRACE_LIDAR];
+        debugSample.y = y;
+        debugSample.Q = Pi;
+        debugPending = true;
+        lock.unlock();
+        debugCv.notify_one();
+    }
+
+    void debug_publisher() {
+        // lowest priority, the estimator must never wait for debug outputs
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+
+        IndirectLidarSample sample;
+        SensorSummary health[N_SENSORS];
+        InputCounts counts[N_SENSORS];
+        double clock[N_SENSORS][2];
+        NisSummary nis[N_SENSORS];
+        double stamp = 0;
+        LoadReport load, change;
+        DeadlineSummary steps;
+        StepOverrun overrun;
+        double overrunTime = 0;
+        StageCounters profile[adaptive_filter::N_PROFILE_STAGES];
+        double profileTime = 0;
+        AllocCounters allocs;
+        double allocTime = 0;
+        while (true) {
+            bool lidarSample, healthSample, loadSample, profileSample, allocSample;
+            uint32_t overrunSample;
+            {
+                std::unique_lock<std::mutex> lock(debugMtx);
+                debugCv.wait(lock, [this] { return debugPending || healthPending || loadChangePending || overrunCount > 0 || profilePending || allocPending || debugStop; });
+                if (debugStop) return;
+
+                overrunSample = overrunCount;
+                if (overrunCount > 0){
+                    overrun = overrunLast;
+                    overrunTime = overrunStamp;
+                    overrunCount = 0;
+                }
+
+                loadSample = loadChangePending;
+                if (loadChangePending){
+                    change = loadChange;
+                    loadChangePending = false;
+                }
+
+                lidarSample = debugPending;
+                if (debugPending){
+                    sample = debugSample;
+                    debugPending = false;
+                }
+
+                profileSample = profilePending;
+                if (profilePending){
+                    std::copy(profileCounters, profileCounters + adaptive_filter::N_PROFILE_STAGES, profile);
+                    profileTime = profileSpan;
+                    profilePending = false;
+                }
+
+                allocSample = allocPending;
+                if (allocPending){
+                    allocs = allocTotals;
+                    allocTime = allocSpan;
+                    allocPending = false;
+                }
+
+                healthSample = healthPending;
+                if (healthPending){
+                    std::copy(healthSummary, healthSummary + N_SENSORS, health);
+                    std::copy(healthCounts, healthCounts + N_SENSORS, counts);
+                    std::copy(&healthClock[0][0], &healthClock[0][0] + 2*N_SENSORS, &clock[0][0]);
+                    std::copy(healthNis, healthNis + N_SENSORS, nis);
+                    stamp = healthStamp;
+                    load = healthLoad;
+                    steps = healthDeadline;
+                    healthPending = false;
+                }
+            }
+
+            if (loadSample){
+                static const char *modes[] = {"normal", "degraded", "overloaded"};
+                if (change.mode == adaptive_filter::NORMAL){
+                    RCLCPP_INFO(this->get_logger(), "Filter load back to normal (%.0f%% of the step).", 100*change.load);
+                } else {
+                    RCLCPP_WARN(this->get_logger(), "Filter %s: %.0f%% of the step, %zu events queued.", modes[change.mode], 100*change.load, change.backlog);
+                }
+            }
+
+            if (overrunSample > 0){
+                report_overrun(overrunTime, overrun, overrunSample);
+            }
+            if (lidarSample){
+                publish_indirect_lidar_sample(sample.stamp, sample.y, sample.Q);
+                ADAPTIVE_FILTER_PROBE3(publish, adaptive_filter::TRACE_INDIRECT_LIDAR, sample.seq, rclcpp::Time(sample.stamp).nanoseconds());
+            }
+            if (profileSample){
+                report_profile(profile, profileTime);
+            }
+            if (allocSample){
+                report_alloc(allocs, allocTime);
+            }
+            if (healthSample){
+                report_consistency(stamp, nis);
+                report_health(stamp, health, counts, clock, load, steps);
+            }
+        }
+    }
+
+    // summarizes the inputs at healthRate and hands them to the debug thread
+    void publish_health(double t_now) {
+        if (healthRate <= 0 || t_now - healthTimeLast < 1.0/healthRate){
+            return;
+        }
+
+        // retried next step while the debug thread holds the mailbox
+        std::unique_lock<std::mutex> lock(debugMtx, std::try_to_lock);
+        if (!lock.owns_lock()){
+            return;
+        }
+        healthTimeLast = t_now;
+
+        imuMonitor.summarize(t_now, healthSummary[0]);
+        wheelMonitor.summarize(t_now, healthSummary[1]);
+        lidarMonitor.summarize(t_now, healthSummary[2]);
+        std::copy(inputCounts, inputCounts + N_SENSORS, healthCounts);
+        imuConsistency.summarize(healthNis[0]);
+        wheelConsistency.summarize(healthNis[1]);
+        lidarConsistency.summarize(healthNis[2]);
+
+        const ClockSync *clocks[N_SENSORS] = {&imuClock, &wheelClock, &lidarClock};
+        for (int i = 0; i < N_SENSORS; i++){
+            healthClock[i][0] = clocks[i]->offset();
+            healthClock[i][1] = clocks[i]->drift();
+        }
+        healthStamp = t_now;
+        healthLoad.mode = loadMode;
+        healthLoad.load = overload.current_load();
+        healthLoad.slack = overload.slack();
+        healthLoad.backlog = overload.current_backlog();
+        deadline.summarize(healthDeadline);
+        healthPending = true;
+        lock.unlock();
+        debugCv.notify_one();
+    }
+
+    // hands the stage counters to the debug thread at profileRate
+    void publish_profile(double t_now) {
+        if (!profiler.is_enabled() || t_now - profileTimeLast < 1.0/profileRate){
+            return;
+        }
+
+        // retried next step while the debug thread holds the mailbox
+        std::unique_lock<std::mutex> lock(debugMtx, std::try_to_lock);
+        if (!lock.owns_lock()){
+            return;
+        }
+        profiler.collect(profileCounters);
+        profileSpan = t_now - profileTimeLast;
+        profilePending = true;
+        lock.unlock();
+        profileTimeLast = t_now;
+        debugCv.notify_one();
+    }
+
+    // hands the allocation totals to the debug thread at allocRate
+    void publish_alloc(double t_now) {
+        if (allocRate <= 0 || t_now - allocTimeLast < 1.0/allocRate){
+            return;
+        }
+
+        // retried next step while the debug thread holds the mailbox
+        std::unique_lock<std::mutex> lock(debugMtx, std::try_to_lock);
+        if (!lock.owns_lock()){
+            return;
+        }
+        adaptive_filter::alloc_counters(allocTotals);
+        allocSpan = t_now - allocTimeLast;
+        allocPending = true;
+        lock.unlock();
+        allocTimeLast = t_now;
+        debugCv.notify_one();
+    }
+
+    // allocation rates per tag and the RSS; after the first window (warm-up)
+    // the filter stages and callbacks must not allocate (debug thread)
+    void report_alloc(const AllocCounters &totals, double span) {
+        size_t rss, peak;
+        adaptive_filter::memory_usage(rss, peak);
+
+        uint64_t allocs = 0, frees = totals.frees - allocReported.frees;
+        for (int i = 0; i < adaptive_filter::N_ALLOC_TAGS; i++){
+            allocs += totals.allocs[i] - allocReported.allocs[i];
+        }
+        RCLCPP_INFO(this->get_logger(), "Memory: RSS %.1f MiB (peak %.1f MiB), %.0f allocations/s, %.0f frees/s.",
+                    rss/1048576.0, peak/1048576.0, allocs/span, frees/span);
+
+        for (int i = 0; i < adaptive_filter::N_ALLOC_TAGS; i++){
+            uint64_t n = totals.allocs[i] - allocReported.allocs[i];
+            if (n == 0){
+                continue;
+            }
+            double bytes = static_cast<double>(totals.bytes[i] - allocReported.bytes[i]);
+            bool filterCode = i != adaptive_filter::ALLOC_OTHER && i != adaptive_filter::ALLOC_OUTPUTS;
+            if (filterCode && allocReports > 0){
+                RCLCPP_WARN(this->get_logger(), "%s allocated in steady state: %.1f allocations/s, %.0f B/s.",
+                            adaptive_filter::alloc_tag_name(i), n/span, bytes/span);
+            } else {
+                RCLCPP_INFO(this->get_logger(), "%s: %.1f allocations/s, %.0f B/s.", adaptive_filter::alloc_tag_name(i), n/span, bytes/span);
+            }
+        }
+
+        allocReported = totals;
+        allocReports++;
+    }
+
+    // IPC and misses per thousand instructions of each stage (debug thread)
+    void report_profile(const StageCounters *counters, double span) {
+        for (int i = 0; i < adaptive_filter::N_PROFILE_STAGES; i++){
+            const StageCounters &c = counters[i];
+            if (c.calls == 0){
+                continue;
+            }
+            double cycles = static_cast<double>(c.counts[adaptive_filter::PERF_CYCLES]);
+            double instructions = static_cast<double>(c.counts[adaptive_filter::PERF_INSTRUCTIONS]);
+            double kilo = instructions > 0 ? instructions/1000 : 1;
+            RCLCPP_INFO(this->get_logger(), "%s: %.0f calls/s, %.0f cycles/call, IPC %.2f, %.2f cache and %.2f branch misses per 1000 instructions.",
+                        adaptive_filter::profile_stage_name(i), c.calls/span, cycles/c.calls,
+                        cycles > 0 ? instructions/cycles : 0.0,
+                        c.counts[adaptive_filter::PERF_CACHE_MISSES]/kilo, c.counts[adaptive_filter::PERF_BRANCH_MISSES]/kilo);
+        }
+    }
+
+    // checks the NIS of the window against its bounds, logs verdict changes and
+    // publishes the consistency summary (debug thread)
+    void report_consistency(double stamp, const NisSummary *nis) {
+        typedef adaptive_filter::msg::NisStatus NisStatus;
+        static const char *verdicts[] = {"covariance too large", "consistent", "covariance too small"};
+
+        for (int i = 0; i < N_SENSORS; i++){
+            NisStatus &status = filterConsistency.sensors[i];
+            adaptive_filter::window_bounds(nis[i], status.mean_lower, status.mean_upper);
+
+            int8_t verdict = NisStatus::CONSISTENT;
+            if (nis[i].samples > 0){
+                if (nis[i].mean < status.mean_lower){
+                    verdict = NisStatus::PESSIMISTIC;
+                } else if (nis[i].mean > status.mean_upper){
+                    verdict = NisStatus::OPTIMISTIC;
+                }
+            }
+            if (verdict != nisVerdict[i]){
+                const std::string &name = status.name;
+                if (verdict == NisStatus::CONSISTENT){
+                    RCLCPP_INFO(this->get_logger(), "Sensor %s corrections consistent again.", name.c_str());
+                } else {
+                    RCLCPP_WARN(this->get_logger(), "Sensor %s corrections inconsistent (%s): mean NIS %.2f outside [%.2f, %.2f].",
+                                name.c_str(), verdicts[verdict + 1], nis[i].mean, status.mean_lower, status.mean_upper);
+                }
+            }
+            nisVerdict[i] = verdict;
+
+            status.dof = nis[i].dof;
+            status.samples = nis[i].samples;
+            status.total_samples = nis[i].totalSamples;
+            status.nis_mean = nis[i].mean;
+            status.nis_max = nis[i].max;
+            status.sample_lower = nis[i].lower;
+            status.sample_upper = nis[i].upper;
+            status.outside_ratio = nis[i].samples > 0 ? static_cast<double>(nis[i].outside)/nis[i].samples : 0;
+            status.verdict = verdict;
+            sensorHealth.sensors[i].nis_mean = nis[i].mean;
+            sensorHealth.sensors[i].nis_verdict = verdict;
+        }
+
+        if (!has_subscribers(pubConsistency)){
+            return;
+        }
+
+        filterConsistency.stamp = rclcpp::Time(static_cast<int64_t>(stamp * 1e9));
+        filterConsistency.confidence = nis[0].confidence;
+
+        publish_message(pubConsistency, filterConsistency);
+    }
+
+    // logs alarm changes and publishes the summary (debug thread)
+    void report_health(double stamp, const SensorSummary *health, const InputCounts *counts, const double (*clock)[2],
+                       const LoadReport &load, const DeadlineSummary &steps) {
+        const bool enabled[N_SENSORS] = {enableImu, enableWheel, enableLidar};
+
+        for (int i = 0; i < N_SENSORS; i++){
+            bool alarm = enabled[i] && health[i].alarm;
+            const std::string &name = sensorHealth.sensors[i].name;
+            if (alarm && !healthAlarm[i]){
+                RCLCPP_WARN(this->get_logger(), "Sensor %s below its expected rate: %.1f Hz of %.1f Hz.", name.c_str(), health[i].rate, health[i].expectedRate);
+            } else if (!alarm && healthAlarm[i]){
+                RCLCPP_INFO(this->get_logger(), "Sensor %s back to %.1f Hz.", name.c_str(), health[i].rate);
+            }
+            healthAlarm[i] = alarm;
+        }
+
+        if (!has_subscribers(pubSensorHealth)){
+            return;
+        }
+
+        sensorHealth.stamp = rclcpp::Time(static_cast<int64_t>(stamp * 1e9));
+        sensorHealth.load_mode = load.mode;
+        sensorHealth.load = load.load;
+        sensorHealth.slack = load.slack;
+        sensorHealth.backlog = static_cast<uint32_t>(load.backlog);
+        sensorHealth.steps = steps.steps;
+        sensorHealth.overruns = steps.overruns;
+        sensorHealth.step_max = steps.durationMax;
+        for (int i = 0; i < adaptive_filter::N_STAGES; i++){
+            sensorHealth.stage_max[i] = steps.stageMax[i];
+            sensorHealth.stage_overruns[i] = steps.stageOverruns[i];
+        }
+        sensorHealth.longest_overrun = steps.longestOverrun;
+        sensorHealth.longest_overrun_stage = steps.longestStage;
+        for (int i = 0; i < N_SENSORS; i++){
+            adaptive_filter::msg::SensorStatus &status = sensorHealth.sensors[i];
+            status.rate = health[i].rate;
+            status.expected_rate = health[i].expectedRate;
+            status.period_mean = health[i].periodMean;
+            status.period_jitter = health[i].periodJitter;
+            status.period_max = health[i].periodMax;
+            status.latency_mean = health[i].latencyMean;
+            status.latency_max = health[i].latencyMax;
+            status.samples = health[i].samples;
+            status.gaps = health[i].gaps;
+            status.drops = health[i].drops;
+            status.out_of_order = health[i].outOfOrder;
+            status.total_samples = health[i].totalSamples;
+            status.total_gaps = health[i].totalGaps;
+            status.total_drops = health[i].totalDrops;
+            status.total_processed = counts[i].processed;
+            status.total_queue_full = counts[i].queueFull;
+            status.total_overwritten = counts[i].overwritten;
+            status.alarm = healthAlarm[i];
+            status.clock_offset = clock[i][0];
+            status.clock_drift = clock[i][1];
+        }
+
+        publish_message(pubSensorHealth, sensorHealth);
+        ADAPTIVE_FILTER_PROBE3(publish, adaptive_filter::TRACE_HEALTH, steps.steps, static_cast<int64_t>(stamp * 1e9));
+    }
+
+    // logs, publishes and hands to the callback the latest overrun (debug thread)
+    void report_overrun(double stamp, const StepOverrun &overrun, uint32_t count) {
+        RCLCPP_WARN_THROTTLE(this->get_logger(), *this->get_clock(), 1000, "Filter step %.2f ms over its %.2f ms deadline, started %.2f ms late, mostly %s (%.2f ms).",
+                             1e3*overrun.overrun, 1e3*deadline.step_deadline(), 1e3*overrun.lateness, adaptive_filter::stage_name(overrun.stage), 1e3*overrun.stages[overrun.stage]);
+
+        if (overrunCallback){
+            overrunCallback(overrun);
+        }
+
+        if (!has_subscribers(pubStepOverrun)){
+            return;
+        }
+
+        stepOverrun.stamp = rclcpp::Time(static_cast<int64_t>(stamp * 1e9));
+        stepOverrun.step = overrun.step;
+        stepOverrun.stage = overrun.stage;
+        for (int i = 0; i < adaptive_filter::N_STAGES; i++){
+            stepOverrun.stage_durations[i] = overrun.stages[i];
+        }
+        stepOverrun.duration = overrun.duration;
+        stepOverrun.lateness = overrun.lateness;
+        stepOverrun.deadline = deadline.step_deadline();
+        stepOverrun.overrun = overrun.overrun;
+        stepOverrun.count = count;
+        stepOverrun.total += count;
+
+        publish_message(pubStepOverrun, stepOverrun);
+        ADAPTIVE_FILTER_PROBE3(publish, adaptive_filter::TRACE_OVERRUN, overrun.step, static_cast<int64_t>(stamp * 1e9));
+    }
+
+    void publish_indirect_lidar_sample(const builtin_interfaces::msg::Time &stamp, const Vector6d &y, const Matrix6d &Pi) {
+        indLiDAROdometry.header.stamp = stamp;
 
         // twist
         indLiDAROdometry.twist.twist.linear.x = y(0);
@@ -713,132 +2300,609 @@ public:
             }
         } 
 
-        pubIndLiDARMeasurement->publish(indLiDAROdometry);
+        publish_message(pubIndLiDARMeasurement, indLiDAROdometry);
+    }
+
+    void publish_filter_state(const StateSnapshot &s) {
+        double t_now = this->get_clock()->now().seconds();
+        if (!pubFilterState || t_now - compactTimeLast < outputScale/compactRate){
+            return;
+        }
+        compactTimeLast = t_now;
+
+        if (!has_subscribers(pubFilterState)){
+            return;
+        }
+
+        filterState.stamp = rclcpp::Time(static_cast<int64_t>(s.stamp * 1e9));
+        filterState.seq++;
+
+        tf2::Quaternion q;
+        q.setRPY(s.X(3), s.X(4), s.X(5));
+        filterState.orientation[0] = q.x();
+        filterState.orientation[1] = q.y();
+        filterState.orientation[2] = q.z();
+        filterState.orientation[3] = q.w();
+
+        for (int i = 0; i < 3; i++){
+            filterState.position[i] = s.X(i);
+        }
+        for (int i = 0; i < 6; i++){
+            filterState.twist[i] = s.X(6 + i);
+        }
+
+        // covariance
+        int k = 0;
+        if (filterState.covariance_type == adaptive_filter::msg::FilterState::TRIANGULAR){
+            for (int i = 0; i < N_STATES; i++){
+                for (int j = i; j < N_STATES; j++){
+                    filterState.covariance[k] = s.P(i,j);
+                    k++;
+                }
+            }
+        } else {
+            for (int i = 0; i < N_STATES; i++){
+                filterState.covariance[i] = s.P(i,i);
+            }
+        }
+
+        publish_message(pubFilterState, filterState);
+        ADAPTIVE_FILTER_PROBE3(publish, adaptive_filter::TRACE_FILTER_STATE, filterState.seq, static_cast<int64_t>(s.stamp * 1e9));
+    }
+
+    void broadcast_tf(const StateSnapshot &s) {
+        double t_now = this->get_clock()->now().seconds();
+        if (tfRate <= 0 || t_now - tfTimeLast < outputScale/tfRate){
+            return;
+        }
+        tfTimeLast = t_now;
+
+        // the graph query is only paid at the TF rate
+        if (tfOnlyWithListeners){
+            ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_OTHER);   // middleware query
+            if (this->count_subscribers("/tf") == 0){
+                return;
+            }
+        }
+
+        filteredOdometryTrans.header.stamp = rclcpp::Time(static_cast<int64_t>(s.stamp * 1e9));
+
+        tf2::Quaternion q;
+        q.setRPY(s.X(3), s.X(4), s.X(5));
+        filteredOdometryTrans.transform.rotation = tf2::toMsg(q);
+        filteredOdometryTrans.transform.translation.x = s.X(0);
+        filteredOdometryTrans.transform.translation.y = s.X(1);
+        filteredOdometryTrans.transform.translation.z = s.X(2);
+
+        {
+            // tf2_ros wraps the transform in a TFMessage for the middleware
+            ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_OTHER);
+            tfBroadcasterfiltered->sendTransform(filteredOdometryTrans);
+        }
+        ADAPTIVE_FILTER_PROBE3(publish, adaptive_filter::TRACE_TF, s.step, static_cast<int64_t>(s.stamp * 1e9));
     }
 
     //----------
     // runs
     //----------
-    void run() {
-        // rate
-        rclcpp::Rate r(200);        
-
-        double t_last = this->get_clock()->now().seconds();
+    void filter_step() {
+        ADAPTIVE_FILTER_ALLOC_SCOPE(adaptive_filter::ALLOC_STEP);
         double t_now;
         double dt_now;
 
-        while (rclcpp::ok()) {
-            // Prediction
-            if (enableFilter){
-                // prediction stage
-                t_now = this->get_clock()->now().seconds();
-                dt_now = t_now - t_last;
-                t_last = t_now;
-
-                prediction_stage(dt_now);
-                
-                // publish state
-                if (filterFreq == "p"){
-                    publish_odom('p');
-                }
+        // lateness of this step after its scheduled release (the latest
+        // 5 ms tick, missed ticks skipped) and the events waiting for the filter
+        const auto period = std::chrono::microseconds(5000);
+        auto stepStart = std::chrono::steady_clock::now();
+        stepRelease += period;
+        if (stepRelease > stepStart){
+            stepRelease = stepStart;
+        }
+        while (stepStart - stepRelease >= period){
+            stepRelease += period;
+        }
+        deadline.begin(stepStart, stepRelease);
+        double lateness = deadline.step_lateness();
+        stepSeq++;
+        // backlog: IMU samples beyond the normal intake of one step, so that
+        // high IMU rates alone do not count as load, plus pending events
+        size_t backlog = std::max(imuQueueCount - imuStepIntake, 0) + (strand ? strand->queued() : 0);
+        metrics.set(metricImuQueue, imuQueueCount);
+        metrics.set(metricBacklog, static_cast<double>(backlog));
+
+        // under overload the LiDAR correction goes first
+        bool lidarFirst = loadMode == adaptive_filter::OVERLOADED;
+
+        // Prediction (piecewise with timeSync, see synchronized_updates())
+        if (enableFilter){
+            t_now = this->get_clock()->now().seconds();
+        }
+        if (enableFilter && !timeSync){
+            // prediction stage
+            dt_now = t_now - t_last;
+            t_last = t_now;
+
+            ADAPTIVE_FILTER_PROBE2(predict_start, stepSeq, static_cast<int64_t>(t_now * 1e9));
+            prediction_stage(dt_now);
+            ADAPTIVE_FILTER_PROBE2(predict_end, stepSeq, static_cast<int64_t>(t_now * 1e9));
+            deadline.mark(adaptive_filter::STAGE_PREDICTION);
+            
+            // publish state
+            if (outputRate <= 0 && filterFreq == "p"){
+                publish_odom('p');
+                deadline.mark(adaptive_filter::STAGE_PUBLISH);
+            }
+        }
+
+        if (enableFilter && timeSync){
+            synchronized_updates(t_now);
+        } else {
+            if (lidarFirst){
+                lidar_update();
+            }
+            imu_update();
+            wheel_update();
+            if (!lidarFirst){
+                lidar_update();
             }
+        }
 
-            // Correction IMU
-            if (enableFilter && enableImu && imuActivated && imuNew){
-                // correction stage
-                correction_imu_stage(imu_dt);
+        // history, same-host state and the outputs of the publisher thread
+        if (enableFilter){
+            record_pose(t_last);
+            sharedState.write(t_last, X.data(), P.data());
+            publish_snapshot();
+        }
+        double t_end = this->get_clock()->now().seconds();
+        publish_health(t_end);
+        publish_profile(t_end);
+        publish_alloc(t_end);
+        deadline.mark(adaptive_filter::STAGE_PUBLISH);
+
+        // step timing; overruns are reported by the debug thread
+        StepOverrun overrun;
+        bool overran = deadline.end(overrun);
+        metrics.add(metricSteps);
+        metrics.observe(metricStepTime, deadline.step_duration());
+        for (int i = 0; i < adaptive_filter::N_STAGES; i++){
+            if (deadline.stage_time(i) > 0){
+                metrics.observe(metricStageTime[i], deadline.stage_time(i));
+            }
+        }
+        if (overran){
+            metrics.add(metricOverruns[overrun.stage]);
+            overrunHeld = overrun;
+            overrunHeldStamp = t_end;
+            overrunHeldCount++;
+        }
 
-                // publish state
-                if (filterFreq == "i"){
-                    publish_odom('i');
-                }
+        // mode for the next step
+        if (loadShedding){
+            double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count();
+            LoadMode mode = overload.update(lateness, duration, backlog);
+            metrics.set(metricLoad, overload.current_load());
+            metrics.set(metricLoadMode, mode);
+            if (mode != loadMode){
+                loadMode = mode;
+                loadChangeHeld.mode = mode;
+                loadChangeHeld.load = overload.current_load();
+                loadChangeHeld.slack = overload.slack();
+                loadChangeHeld.backlog = backlog;
+                loadChangeHeldPending = true;
+            }
+        }
 
-                // control variable
-                imuNew = false;
+        // handed to the debug thread when the mailbox is free, or held for
+        // the next step (overruns keep counting, the latest one is kept)
+        if (overrunHeldCount > 0 || loadChangeHeldPending){
+            std::unique_lock<std::mutex> lock(debugMtx, std::try_to_lock);
+            if (lock.owns_lock()){
+                if (overrunHeldCount > 0){
+                    overrunLast = overrunHeld;
+                    overrunStamp = overrunHeldStamp;
+                    overrunCount += overrunHeldCount;
+                    overrunHeldCount = 0;
+                }
+                if (loadChangeHeldPending){
+                    loadChange = loadChangeHeld;
+                    loadChangePending = true;
+                    loadChangeHeldPending = false;
+                }
+                lock.unlock();
+                debugCv.notify_one();
             }
+        }
+    }
 
-            // Correction wheel
-            if (enableFilter && enableWheel && wheelActivated && wheelNew){                
-                // correction stage
-                correction_wheel_stage(wheel_dt);
+    void imu_sample_update(int i) {
+        const ImuSample &sample = imu_sample(i);
+        imuMeasure = sample.y;
+        E_imu = sample.E;
+        headerI.stamp = sample.stamp;
+        int64_t stamp = rclcpp::Time(sample.stamp).nanoseconds();
+        ADAPTIVE_FILTER_PROBE3(correct_start, adaptive_filter::TRACE_IMU, sample.seq, stamp);
+        correction_imu_stage(imu_dt);
+        ADAPTIVE_FILTER_PROBE3(correct_end, adaptive_filter::TRACE_IMU, sample.seq, stamp);
+        inputCounts[adaptive_filter::TRACE_IMU].processed++;
+        metrics.add(metricProcessed[adaptive_filter::TRACE_IMU]);
+    }
 
-                if (filterFreq == "w"){
-                    publish_odom('w');
-                }                
+    void imu_aggregate_update() {
+        uint64_t seq = imu_sample(imuQueueCount - 1).seq;
+        aggregate_imu();
+        int64_t stamp = rclcpp::Time(headerI.stamp).nanoseconds();
+        ADAPTIVE_FILTER_PROBE3(correct_start, adaptive_filter::TRACE_IMU, seq, stamp);
+        correction_imu_stage(imu_dt);
+        ADAPTIVE_FILTER_PROBE3(correct_end, adaptive_filter::TRACE_IMU, seq, stamp);
+        inputCounts[adaptive_filter::TRACE_IMU].processed += imuQueueCount;
+        metrics.add(metricProcessed[adaptive_filter::TRACE_IMU], imuQueueCount);
+    }
 
-                // control variable
-                wheelNew = false;
+    bool imu_aggregated() const {
+        return (imuAggregate || loadMode != adaptive_filter::NORMAL) && imuQueueCount > 1;
+    }
+
+    // the queue was applied
+    void imu_queue_done() {
+        imuQueueHead = 0;
+        imuQueueCount = 0;
+        deadline.mark(adaptive_filter::STAGE_IMU);
+
+        // publish state
+        if (outputRate <= 0 && filterFreq == "i"){
+            publish_odom('i');
+            deadline.mark(adaptive_filter::STAGE_PUBLISH);
+        }
+
+        // control variable
+        imuNew = false;
+    }
+
+    void imu_update() {
+        // Correction IMU
+        if (enableFilter && enableImu && imuActivated && imuNew){
+            // correction stage, one update per queued sample or one for all
+            // (always coalesced under load)
+            if (imu_aggregated()){
+                imu_aggregate_update();
+            } else {
+                for (int i = 0; i < imuQueueCount; i++){
+                    imu_sample_update(i);
+                }
             }
+            imu_queue_done();
+        }
+    }
+
+    void wheel_update() {
+        // Correction wheel
+        if (enableFilter && enableWheel && wheelActivated && wheelNew){                
+            // correction stage
+            int64_t stamp = rclcpp::Time(headerW.stamp).nanoseconds();
+            ADAPTIVE_FILTER_PROBE3(correct_start, adaptive_filter::TRACE_WHEEL, inputSeq[adaptive_filter::TRACE_WHEEL], stamp);
+            correction_wheel_stage(wheel_dt);
+            ADAPTIVE_FILTER_PROBE3(correct_end, adaptive_filter::TRACE_WHEEL, inputSeq[adaptive_filter::TRACE_WHEEL], stamp);
+            inputCounts[adaptive_filter::TRACE_WHEEL].processed++;
+            metrics.add(metricProcessed[adaptive_filter::TRACE_WHEEL]);
+            deadline.mark(adaptive_filter::STAGE_WHEEL);
+
+            if (outputRate <= 0 && filterFreq == "w"){
+                publish_odom('w');
+                deadline.mark(adaptive_filter::STAGE_PUBLISH);
+            }                
+
+            // control variable
+            wheelNew = false;
+        }
+    }
 
-            // Correction LiDAR
-            if (enableFilter && enableLidar && lidarActivated && lidarNew){                
-                // correction stage
-                correction_lidar_stage(lidar_dt);
+    // prediction from t_last to t, with the share of the step's process
+    // noise that the piece covers; nothing is predicted backwards
+    void predict_to(double t, double span) {
+        if (t <= t_last){
+            return;
+        }
+        double dt = t - t_last;
+        prediction_stage(dt, span > 0 ? dt/span : 1.0);
+        t_last = t;
+    }
 
-                // publish state
-                if (filterFreq == "l"){
-                    publish_odom('l');
+    // With timeSync the measurements of the step are applied in the order of
+    // their corrected (host time) stamps, each after a prediction to its
+    // time, and the state is then predicted to t_now. Samples older than the
+    // previous step are applied at its time. The order replaces the LiDAR
+    // first rule of the overloaded mode.
+    void synchronized_updates(double t_now) {
+        const double NONE = std::numeric_limits<double>::infinity();
+        double span = t_now - t_last;
+
+        bool imu = enableImu && imuActivated && imuNew;
+        bool aggregated = imu && imu_aggregated();
+        int nImu = !imu ? 0 : aggregated ? 1 : imuQueueCount;
+        bool wheel = enableWheel && wheelActivated && wheelNew;
+        bool lidar = enableLidar && lidarActivated && lidarNew;
+
+        int i = 0;
+        while (true) {
+            // an aggregated measurement is applied at its newest sample
+            double tImu = i >= nImu ? NONE : imu_sample(aggregated ? imuQueueCount - 1 : i).time;
+            double tWheel = wheel ? wheelTimeCurrent : NONE;
+            double tLidar = lidar ? lidarTimeCurrent : NONE;
+            double t = std::min(tImu, std::min(tWheel, tLidar));
+            if (t == NONE){
+                break;
+            }
+
+            predict_to(std::min(t, t_now), span);
+            if (t == tImu){
+                if (aggregated){
+                    imu_aggregate_update();
+                } else {
+                    imu_sample_update(i);
                 }
+                i++;
+            } else if (t == tWheel){
+                wheel_update();
+                wheel = false;
+            } else {
+                lidar_update();
+                lidar = false;
+            }
+        }
+        if (imu){
+            imu_queue_done();
+        }
+
+        ADAPTIVE_FILTER_PROBE2(predict_start, stepSeq, static_cast<int64_t>(t_now * 1e9));
+        predict_to(t_now, span);
+        ADAPTIVE_FILTER_PROBE2(predict_end, stepSeq, static_cast<int64_t>(t_now * 1e9));
+        deadline.mark(adaptive_filter::STAGE_PREDICTION);
 
-                // control variable
-                lidarNew = false;
+        // publish state
+        if (outputRate <= 0 && filterFreq == "p"){
+            publish_odom('p');
+            deadline.mark(adaptive_filter::STAGE_PUBLISH);
+        }
+    }
+
+    void lidar_update() {
+        // Correction LiDAR
+        if (enableFilter && enableLidar && lidarActivated && lidarNew){                
+            // correction stage
+            int64_t stamp = rclcpp::Time(headerL.stamp).nanoseconds();
+            ADAPTIVE_FILTER_PROBE3(correct_start, adaptive_filter::TRACE_LIDAR, inputSeq[adaptive_filter::TRACE_LIDAR], stamp);
+            correction_lidar_stage(lidar_dt);
+            ADAPTIVE_FILTER_PROBE3(correct_end, adaptive_filter::TRACE_LIDAR, inputSeq[adaptive_filter::TRACE_LIDAR], stamp);
+            inputCounts[adaptive_filter::TRACE_LIDAR].processed++;
+            metrics.add(metricProcessed[adaptive_filter::TRACE_LIDAR]);
+            deadline.mark(adaptive_filter::STAGE_LIDAR);
+
+            // publish state
+            if (outputRate <= 0 && filterFreq == "l"){
+                publish_odom('l');
+                deadline.mark(adaptive_filter::STAGE_PUBLISH);
             }
-            
-            rclcpp::spin_some(this->get_node_base_interface());
-            r.sleep();        
+
+            // control variable
+            lidarNew = false;
         }
     }
 };
 
 
+//-----------------------------
+// Parameters
+//-----------------------------
+template <typename NodeT>
+FilterParameters get_filter_parameters(NodeT *nh_, const std::string &prefix, const FilterParameters &defaults) {
+    FilterParameters parameters = defaults;
+
+    nh_->declare_parameter(prefix + "enableImu", defaults.enableImu);
+    nh_->declare_parameter(prefix + "enableWheel", defaults.enableWheel);
+    nh_->declare_parameter(prefix + "enableLidar", defaults.enableLidar);
+    nh_->declare_parameter(prefix + "filterFreq", defaults.filterFreq);
+
+    nh_->declare_parameter(prefix + "lidarG", defaults.lidarG);
+    nh_->declare_parameter(prefix + "wheelG", defaults.wheelG);
+    nh_->declare_parameter(prefix + "imuG", defaults.imuG);
+
+    nh_->declare_parameter(prefix + "tfRate", defaults.tfRate);
+    nh_->declare_parameter(prefix + "tfOnlyWithListeners", defaults.tfOnlyWithListeners);
+    nh_->declare_parameter(prefix + "parentFrame", defaults.parentFrame);
+    nh_->declare_parameter(prefix + "childFrame", defaults.childFrame);
+
+    nh_->declare_parameter(prefix + "outputRate", defaults.outputRate);
+
+    nh_->declare_parameter(prefix + "compactRate", defaults.compactRate);
+    nh_->declare_parameter(prefix + "compactCovariance", defaults.compactCovariance);
+
+    nh_->declare_parameter(prefix + "historySize", defaults.historySize);
+    nh_->declare_parameter(prefix + "historyMaxExtrapolation", defaults.historyMaxExtrapolation);
+
+    nh_->declare_parameter(prefix + "sharedStateName", defaults.sharedStateName);
+
+    nh_->declare_parameter(prefix + "serializedInput", defaults.serializedInput);
+    nh_->declare_parameter(prefix + "sensorQos", defaults.sensorQos);
+
+    nh_->declare_parameter(prefix + "imuAggregate", defaults.imuAggregate);
+
+    nh_->declare_parameter(prefix + "healthRate", defaults.healthRate);
+    nh_->declare_parameter(prefix + "imuExpectedRate", defaults.imuExpectedRate);
+    nh_->declare_parameter(prefix + "wheelExpectedRate", defaults.wheelExpectedRate);
+    nh_->declare_parameter(prefix + "lidarExpectedRate", defaults.lidarExpectedRate);
+    nh_->declare_parameter(prefix + "rateAlarmRatio", defaults.rateAlarmRatio);
+
+    nh_->declare_parameter(prefix + "timeSync", defaults.timeSync);
+
+    nh_->declare_parameter(prefix + "loadShedding", defaults.loadShedding);
+    nh_->declare_parameter(prefix + "degradeLoad", defaults.degradeLoad);
+    nh_->declare_parameter(prefix + "overloadLoad", defaults.overloadLoad);
+    nh_->declare_parameter(prefix + "degradeBacklog", defaults.degradeBacklog);
+    nh_->declare_parameter(prefix + "overloadBacklog", defaults.overloadBacklog);
+    nh_->declare_parameter(prefix + "stepDeadline", defaults.stepDeadline);
+    nh_->declare_parameter(prefix + "overrunTopic", defaults.overrunTopic);
+    nh_->declare_parameter(prefix + "profileRate", defaults.profileRate);
+    nh_->declare_parameter(prefix + "allocRate", defaults.allocRate);
+    nh_->declare_parameter(prefix + "nisConfidence", defaults.nisConfidence);
+    nh_->declare_parameter(prefix + "consistencyTopic", defaults.consistencyTopic);
+    nh_->declare_parameter(prefix + "metricsEndpoint", defaults.metricsEndpoint);
+
+    nh_->get_parameter(prefix + "enableImu", parameters.enableImu);
+    nh_->get_parameter(prefix + "enableWheel", parameters.enableWheel);
+    nh_->get_parameter(prefix + "enableLidar", parameters.enableLidar);
+    nh_->get_parameter(prefix + "filterFreq", parameters.filterFreq);
+
+    nh_->get_parameter(prefix + "lidarG", parameters.lidarG);
+    nh_->get_parameter(prefix + "wheelG", parameters.wheelG);
+    nh_->get_parameter(prefix + "imuG", parameters.imuG);
+
+    nh_->get_parameter(prefix + "tfRate", parameters.tfRate);
+    nh_->get_parameter(prefix + "tfOnlyWithListeners", parameters.tfOnlyWithListeners);
+    nh_->get_parameter(prefix + "parentFrame", parameters.parentFrame);
+    nh_->get_parameter(prefix + "childFrame", parameters.childFrame);
+
+    nh_->get_parameter(prefix + "outputRate", parameters.outputRate);
+
+    nh_->get_parameter(prefix + "compactRate", parameters.compactRate);
+    nh_->get_parameter(prefix + "compactCovariance", parameters.compactCovariance);
+
+    nh_->get_parameter(prefix + "historySize", parameters.historySize);
+    nh_->get_parameter(prefix + "historyMaxExtrapolation", parameters.historyMaxExtrapolation);
+
+    nh_->get_parameter(prefix + "sharedStateName", parameters.sharedStateName);
+
+    nh_->get_parameter(prefix + "serializedInput", parameters.serializedInput);
+    nh_->get_parameter(prefix + "sensorQos", parameters.sensorQos);
+
+    nh_->get_parameter(prefix + "imuAggregate", parameters.imuAggregate);
+
+    nh_->get_parameter(prefix + "healthRate", parameters.healthRate);
+    nh_->get_parameter(prefix + "imuExpectedRate", parameters.imuExpectedRate);
+    nh_->get_parameter(prefix + "wheelExpectedRate", parameters.wheelExpectedRate);
+    nh_->get_parameter(prefix + "lidarExpectedRate", parameters.lidarExpectedRate);
+    nh_->get_parameter(prefix + "rateAlarmRatio", parameters.rateAlarmRatio);
+
+    nh_->get_parameter(prefix + "timeSync", parameters.timeSync);
+
+    nh_->get_parameter(prefix + "loadShedding", parameters.loadShedding);
+    nh_->get_parameter(prefix + "degradeLoad", parameters.degradeLoad);
+    nh_->get_parameter(prefix + "overloadLoad", parameters.overloadLoad);
+    nh_->get_parameter(prefix + "degradeBacklog", parameters.degradeBacklog);
+    nh_->get_parameter(prefix + "overloadBacklog", parameters.overloadBacklog);
+    nh_->get_parameter(prefix + "stepDeadline", parameters.stepDeadline);
+    nh_->get_parameter(prefix + "overrunTopic", parameters.overrunTopic);
+    nh_->get_parameter(prefix + "profileRate", parameters.profileRate);
+    nh_->get_parameter(prefix + "allocRate", parameters.allocRate);
+    nh_->get_parameter(prefix + "nisConfidence", parameters.nisConfidence);
+    nh_->get_parameter(prefix + "consistencyTopic", parameters.consistencyTopic);
+    nh_->get_parameter(prefix + "metricsEndpoint", parameters.metricsEndpoint);
+
+    return parameters;
+}
+
+
+#if defined(ADAPTIVE_FILTER_TEST)
+// built into the tests, without main()
+#elif defined(ADAPTIVE_FILTER_COMPONENT)
+#include <rclcpp_components/register_node_macro.hpp>
+RCLCPP_COMPONENTS_REGISTER_NODE(AdaptiveFilter)
+
+// the component without the class loader, for in-process tools (EKFLatencyHarness)
+std::shared_ptr<rclcpp_lifecycle::LifecycleNode> make_adaptive_filter(const rclcpp::NodeOptions &options) {
+    return std::make_shared<AdaptiveFilter>(options);
+}
+#else
 //-----------------------------
 // Main 
 //-----------------------------
 int main(int argc, char** argv) {
     rclcpp::init(argc, argv);
 
-    //Parameters init:    
+    std::string node_name = "adaptive_filter";
+    if (argc > 1) {
+        node_name = argv[1];
+    }
+
+    // Pool mode: one filter per name in "filters", all sharing a thread pool
     auto nh_ = rclcpp::Node::make_shared("adaptive_filter");
+    FilterParameters parameters;
+    std::vector<std::string> filters;
+    int threads = 0;
+    bool autostart = true;
     try {
-        nh_->declare_parameter("/ekf_loam/enableFilter", true);
-        nh_->declare_parameter("/adaptive_filter/enableImu", true);
-        nh_->declare_parameter("/adaptive_filter/enableWheel", true);
-        nh_->declare_parameter("/adaptive_filter/enableLidar", true);
-        nh_->declare_parameter("/adaptive_filter/filterFreq", std::string("l"));
-
-        nh_->declare_parameter("/adaptive_filter/lidarG", float(1000));
-        nh_->declare_parameter("/adaptive_filter/wheelG", float(0.05));
-        nh_->declare_parameter("/adaptive_filter/imuG", float(0.1));
-
-        nh_->get_parameter("/ekf_loam/enableFilter", enableFilter);
-        nh_->get_parameter("/adaptive_filter/enableImu", enableImu);
-        nh_->get_parameter("/adaptive_filter/enableWheel", enableWheel);
-        nh_->get_parameter("/adaptive_filter/enableLidar", enableLidar);
-        nh_->get_parameter("/adaptive_filter/filterFreq", filterFreq);
-
-        nh_->get_parameter("/adaptive_filter/lidarG", lidarG);
-        nh_->get_parameter("/adaptive_filter/wheelG", wheelG);
-        nh_->get_parameter("/adaptive_filter/imuG", imuG);
+        nh_->declare_parameter("/adaptive_filter/filters", std::vector<std::string>());
+        nh_->declare_parameter("/adaptive_filter/threads", 0);
+
+        nh_->get_parameter("/adaptive_filter/filters", filters);
+        nh_->get_parameter("/adaptive_filter/threads", threads);
+
+        nh_->declare_parameter("/adaptive_filter/autostart", autostart);
+        nh_->get_parameter("/adaptive_filter/autostart", autostart);
+
+        if (!filters.empty()) {
+            nh_->declare_parameter("/ekf_loam/enableFilter", true);
+            nh_->get_parameter("/ekf_loam/enableFilter", parameters.enableFilter);
+
+            parameters = get_filter_parameters(nh_.get(), "/adaptive_filter/", parameters);
+        }
     } catch (int e) {
         RCLCPP_INFO(nh_->get_logger(), "Exception occurred when importing parameters in Adaptive Filter Node. Exception Nr. %d", e);
     }
 
-    std::string node_name = "adaptive_filter";
-    if (argc > 1) {
-        node_name = argv[1];
+    if (!filters.empty()) {
+        WorkStealingPool pool(threads);
+        rclcpp::executors::SingleThreadedExecutor executor;
+        std::vector<std::shared_ptr<AdaptiveFilter>> afs;
+
+        for (const std::string &name : filters) {
+            // each filter broadcasts its own frames and writes its own
+            // shared-memory state unless overridden
+            FilterParameters filter_defaults = parameters;
+            filter_defaults.parentFrame = name + "/" + parameters.parentFrame;
+            filter_defaults.childFrame = name + "/" + parameters.childFrame;
+            if (!parameters.sharedStateName.empty()) {
+                filter_defaults.sharedStateName = parameters.sharedStateName + "_" + name;
+            }
+            FilterParameters filter_parameters = get_filter_parameters(nh_.get(), "/adaptive_filter/" + name + "/", filter_defaults);
+            nh_->declare_parameter("/adaptive_filter/" + name + "/enableFilter", parameters.enableFilter);
+            nh_->get_parameter("/adaptive_filter/" + name + "/enableFilter", filter_parameters.enableFilter);
+
+            afs.push_back(std::make_shared<AdaptiveFilter>(node_name, filter_parameters, "/" + name, pool.make_strand()));
+            executor.add_node(afs.back()->get_node_base_interface());
+            if (autostart) {
+                afs.back()->configure();
+                if (filter_parameters.enableFilter) {
+                    afs.back()->activate();
+                }
+            }
+        }
+
+        RCLCPP_INFO(rclcpp::get_logger(node_name), "Adaptive Filter Started with %zu filters on %zu threads.", afs.size(), pool.size());
+        executor.spin();
+
+        pool.shutdown();
+        rclcpp::shutdown();
+        return 0;
     }
+    nh_.reset();
 
-    auto af = std::make_shared<AdaptiveFilter>(node_name);
+    // Single filter: the same node that is loaded as a component; without
+    // autostart it waits unconfigured for a lifecycle manager
+    auto af = std::make_shared<AdaptiveFilter>(node_name, rclcpp::NodeOptions());
 
-    if (enableFilter) {
+    if (!autostart) {
+        RCLCPP_INFO(rclcpp::get_logger(node_name), "Adaptive Filter waiting for configuration.");
+    } else if (af->enabled()) {
+        af->configure();
+        af->activate();
         RCLCPP_INFO(rclcpp::get_logger(node_name), "Adaptive Filter Started.");
-        // runs
-        af->run();
     } else {
+        af->configure();
         RCLCPP_INFO(rclcpp::get_logger(node_name), "Adaptive Filter Stopped.");
     }
 
-    rclcpp::spin(af);
+    rclcpp::spin(af->get_node_base_interface());
     rclcpp::shutdown();
     return 0;
 }
+#endif
@@ -0,0 +1,291 @@
+#include <rclcpp/rclcpp.hpp>
+#include <std_msgs/msg/header.hpp>
+#include <sensor_msgs/msg/imu.hpp>
+#include <nav_msgs/msg/odometry.hpp>
+#include <tf2_geometry_msgs/tf2_geometry_msgs.h>
+#include <tf2/transform_datatypes.h>
+#include <adaptive_filter/BatchedAdaptiveFilter.h>
+#include <chrono>
+
+using namespace std;
+using adaptive_filter::BatchedAdaptiveFilter;
+
+//-----------------------------
+// Global variables
+//-----------------------------
+bool enableImu;
+bool enableWheel;
+bool enableLidar;
+
+float lidarG;
+float wheelG;
+float imuG;
+
+std::string filterFreq;
+
+std::vector<std::string> namespaces;
+
+// frames of the filtered pose, "<ns>/<frame>" per robot
+std::string parentFrame;
+std::string childFrame;
+
+//-----------------------------
+// Fleet adapter class
+//-----------------------------
+// Hosts one BatchedAdaptiveFilter lane per robot namespace. Topics of robot
+// k are "<ns_k>/imu", "<ns_k>/odom", "<ns_k>/odom_rf2o" and its output is
+// "<ns_k>/ekf_loam/filter_odom_to_init". All lanes are predicted and
+// corrected in lockstep by a single 200 Hz timer.
+class AdaptiveFilterFleet : public rclcpp::Node {
+
+private:
+    // Subscriber
+    std::vector<rclcpp::Subscription<sensor_msgs::msg::Imu>::SharedPtr> subImu;
+    std::vector<rclcpp::Subscription<nav_msgs::msg::Odometry>::SharedPtr> subWheelOdometry;
+    std::vector<rclcpp::Subscription<nav_msgs::msg::Odometry>::SharedPtr> subLaserOdometry;
+
+    // Publisher
+    std::vector<rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr> pubFilteredOdometry;
+
+    // Timer
+    rclcpp::TimerBase::SharedPtr timer;
+
+    // header stamp of the last measure of each lane
+    std::vector<builtin_interfaces::msg::Time> stampI, stampW, stampL;
+
+    // filtered odom
+    std::vector<nav_msgs::msg::Odometry> filteredOdometries;
+
+    // filter bank
+    BatchedAdaptiveFilter filters;
+    BatchedAdaptiveFilter::Lanes dt;
+    BatchedAdaptiveFilter::LaneMask publishNow;
+
+    double t_last;
+
+public:
+    AdaptiveFilterFleet(const std::string &node_name) : Node(node_name),
+        filters(namespaces.size(), lidarG, wheelG, imuG) {
+        int n = filters.size();
+
+        stampI.resize(n);
+        stampW.resize(n);
+        stampL.resize(n);
+        dt.resize(n);
+        publishNow.resize(n);
+
+        for (int k = 0; k < n; k++){
+            const std::string &ns = namespaces[k];
+
+            // Subscriber
+            subImu.push_back(this->create_subscription<sensor_msgs::msg::Imu>(
+                ns + "/imu", 50, [this, k](const sensor_msgs::msg::Imu::SharedPtr msg) { imuHandler(k, msg); }));
+            subWheelOdometry.push_back(this->create_subscription<nav_msgs::msg::Odometry>(
+                ns + "/odom", 5, [this, k](const nav_msgs::msg::Odometry::SharedPtr msg) { wheelOdometryHandler(k, msg); }));
+            subLaserOdometry.push_back(this->create_subscription<nav_msgs::msg::Odometry>(
+                ns + "/odom_rf2o", 5, [this, k](const nav_msgs::msg::Odometry::SharedPtr msg) { laserOdometryHandler(k, msg); }));
+
+            // Publisher
+            pubFilteredOdometry.push_back(this->create_publisher<nav_msgs::msg::Odometry>(ns + "/ekf_loam/filter_odom_to_init", 5));
+        }
+
+        filteredOdometries.resize(n);
+        for (int k = 0; k < n; k++){
+            std::string prefix = namespaces[k];
+            prefix.erase(0, prefix.find_first_not_of('/'));
+            filteredOdometries[k].header.frame_id = prefix.empty() ? parentFrame : prefix + "/" + parentFrame;
+            filteredOdometries[k].child_frame_id = prefix.empty() ? childFrame : prefix + "/" + childFrame;
+        }
+
+        t_last = this->get_clock()->now().seconds();
+        timer = this->create_wall_timer(std::chrono::milliseconds(5), std::bind(&AdaptiveFilterFleet::step, this));
+
+        RCLCPP_INFO(this->get_logger(), "Adaptive Filter Fleet hosting %d filters.", n);
+    }
+
+    //----------
+    // callbacks
+    //----------
+    void imuHandler(int k, const sensor_msgs::msg::Imu::SharedPtr imuIn) {
+        // roll, pitch and yaw
+        double roll, pitch, yaw;
+        geometry_msgs::msg::Quaternion orientation = imuIn->orientation;
+        tf2::Matrix3x3(tf2::Quaternion(orientation.x, orientation.y, orientation.z, orientation.w)).getRPY(roll, pitch, yaw);
+
+        filters.set_imu(k, roll, pitch, yaw, imuIn->orientation_covariance.data());
+        stampI[k] = imuIn->header.stamp;
+    }
+
+    void wheelOdometryHandler(int k, const nav_msgs::msg::Odometry::SharedPtr wheelOdometry) {
+        filters.set_wheel(k, wheelOdometry->twist.twist.linear.x, wheelOdometry->twist.twist.angular.z,
+                          wheelOdometry->twist.covariance[0], wheelOdometry->twist.covariance[35]);
+        stampW[k] = wheelOdometry->header.stamp;
+    }
+
+    void laserOdometryHandler(int k, const nav_msgs::msg::Odometry::SharedPtr laserOdometry) {
+        // roll, pitch and yaw
+        double pose[6];
+        geometry_msgs::msg::Quaternion orientation = laserOdometry->pose.pose.orientation;
+        tf2::Matrix3x3(tf2::Quaternion(orientation.x, orientation.y, orientation.z, orientation.w)).getRPY(pose[3], pose[4], pose[5]);
+
+        pose[0] = laserOdometry->pose.pose.position.x;
+        pose[1] = laserOdometry->pose.pose.position.y;
+        pose[2] = laserOdometry->pose.pose.position.z;
+
+        // covariance
+        double corner = double(laserOdometry->twist.twist.linear.x);
+        double surf = double(laserOdometry->twist.twist.angular.x);
+
+        filters.set_lidar(k, pose, corner, surf);
+        stampL[k] = laserOdometry->header.stamp;
+    }
+
+    //----------
+    // runs
+    //----------
+    void step() {
+        int n = filters.size();
+
+        // prediction stage
+        double t_now = this->get_clock()->now().seconds();
+        dt.setConstant(t_now - t_last);
+        t_last = t_now;
+
+        filters.prediction_stage(dt);
+
+        // lanes whose output follows the sensor corrected in this step
+        for (int k = 0; k < n; k++){
+            switch (filterFreq[0]) {
+                case 'i':
+                    publishNow(k) = enableImu && filters.imu_pending(k);
+                    break;
+                case 'w':
+                    publishNow(k) = enableWheel && filters.wheel_pending(k);
+                    break;
+                case 'l':
+                    publishNow(k) = enableLidar && filters.lidar_pending(k);
+                    break;
+                default:
+                    publishNow(k) = true;
+            }
+        }
+
+        // correction stages
+        if (enableImu){
+            filters.correction_imu_stage();
+        }
+        if (enableWheel){
+            filters.correction_wheel_stage();
+        }
+        if (enableLidar){
+            dt.setConstant(0.1);
+            filters.correction_lidar_stage(dt);
+        }
+
+        for (int k = 0; k < n; k++){
+            if (publishNow(k)){
+                publish_odom(k);
+            }
+        }
+    }
+
+    //----------
+    // publisher
+    //----------
+    void publish_odom(int k) {
+        nav_msgs::msg::Odometry &filteredOdometry = filteredOdometries[k];
+        switch (filterFreq[0]) {
+            case 'i':
+                filteredOdometry.header.stamp = stampI[k];
+                break;
+            case 'w':
+                filteredOdometry.header.stamp = stampW[k];
+                break;
+            case 'l':
+                filteredOdometry.header.stamp = stampL[k];
+                break;
+            default:
+                filteredOdometry.header.stamp = this->get_clock()->now();
+        }
+
+        // Create quaternion from roll, pitch, yaw
+        tf2::Quaternion q;
+        q.setRPY(filters.state(k,3), filters.state(k,4), filters.state(k,5));
+        filteredOdometry.pose.pose.orientation = tf2::toMsg(q);
+
+        // pose
+        filteredOdometry.pose.pose.position.x = filters.state(k,0);
+        filteredOdometry.pose.pose.position.y = filters.state(k,1);
+        filteredOdometry.pose.pose.position.z = filters.state(k,2);
+
+        // twist
+        filteredOdometry.twist.twist.linear.x = filters.state(k,6);
+        filteredOdometry.twist.twist.linear.y = filters.state(k,7);
+        filteredOdometry.twist.twist.linear.z = filters.state(k,8);
+        filteredOdometry.twist.twist.angular.x = filters.state(k,9);
+        filteredOdometry.twist.twist.angular.y = filters.state(k,10);
+        filteredOdometry.twist.twist.angular.z = filters.state(k,11);
+
+        // pose and twist convariances
+        for (int i = 0; i < 6; i++){
+            for (int j = 0; j < 6; j++){
+                filteredOdometry.pose.covariance[i*6 + j] = filters.covariance(k, i, j);
+                filteredOdometry.twist.covariance[i*6 + j] = filters.covariance(k, i + 6, j + 6);
+            }
+        }
+
+        pubFilteredOdometry[k]->publish(filteredOdometry);
+    }
+};
+
+
+//-----------------------------
+// Main
+//-----------------------------
+int main(int argc, char** argv) {
+    rclcpp::init(argc, argv);
+
+    //Parameters init:
+    auto nh_ = rclcpp::Node::make_shared("adaptive_filter_fleet_params");
+    try {
+        nh_->declare_parameter("/adaptive_filter/enableImu", true);
+        nh_->declare_parameter("/adaptive_filter/enableWheel", true);
+        nh_->declare_parameter("/adaptive_filter/enableLidar", true);
+        nh_->declare_parameter("/adaptive_filter/filterFreq", std::string("l"));
+
+        nh_->declare_parameter("/adaptive_filter/lidarG", float(1000));
+        nh_->declare_parameter("/adaptive_filter/wheelG", float(0.05));
+        nh_->declare_parameter("/adaptive_filter/imuG", float(0.1));
+
+        nh_->declare_parameter("/adaptive_filter/namespaces", std::vector<std::string>());
+        nh_->declare_parameter("/adaptive_filter/parentFrame", std::string("chassis_init"));
+        nh_->declare_parameter("/adaptive_filter/childFrame", std::string("ekf_odom_frame"));
+
+        nh_->get_parameter("/adaptive_filter/enableImu", enableImu);
+        nh_->get_parameter("/adaptive_filter/enableWheel", enableWheel);
+        nh_->get_parameter("/adaptive_filter/enableLidar", enableLidar);
+        nh_->get_parameter("/adaptive_filter/filterFreq", filterFreq);
+
+        nh_->get_parameter("/adaptive_filter/lidarG", lidarG);
+        nh_->get_parameter("/adaptive_filter/wheelG", wheelG);
+        nh_->get_parameter("/adaptive_filter/imuG", imuG);
+
+        nh_->get_parameter("/adaptive_filter/namespaces", namespaces);
+        nh_->get_parameter("/adaptive_filter/parentFrame", parentFrame);
+        nh_->get_parameter("/adaptive_filter/childFrame", childFrame);
+    } catch (int e) {
+        RCLCPP_INFO(nh_->get_logger(), "Exception occurred when importing parameters in Adaptive Filter Fleet Node. Exception Nr. %d", e);
+    }
+
+    if (namespaces.empty()) {
+        RCLCPP_INFO(nh_->get_logger(), "Adaptive Filter Fleet: no namespaces given, nothing to run.");
+        rclcpp::shutdown();
+        return 0;
+    }
+
+    auto fleet = std::make_shared<AdaptiveFilterFleet>("adaptive_filter_fleet");
+
+    rclcpp::spin(fleet);
+    rclcpp::shutdown();
+    return 0;
+}
@@ -0,0 +1,438 @@
+#include <rclcpp/rclcpp.hpp>
+#include <rclcpp_lifecycle/lifecycle_node.hpp>
+#include <std_msgs/msg/header.hpp>
+#include <sensor_msgs/msg/imu.hpp>
+#include <nav_msgs/msg/odometry.hpp>
+#include <tf2_geometry_msgs/tf2_geometry_msgs.h>
+#include <tf2/transform_datatypes.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// adaptive_filter_component
+std::shared_ptr<rclcpp_lifecycle::LifecycleNode> make_adaptive_filter(const rclcpp::NodeOptions &options);
+
+//-----------------------------
+// Global variables
+//-----------------------------
+std::string ns;
+
+// filter built in this process (else a filter already running on the host)
+bool inProcess;
+bool intraProcess;
+
+// executor of this process: "single", "multi" or "static", and the threads
+// of "multi" (0: one per core)
+std::string executorType;
+int threads;
+
+// QoS of the inputs and of the output subscription: "reliable" or
+// "best_effort", and the history depth
+std::string reliability;
+int depth;
+
+// output path of the filter (filterFreq): 'i', 'w', 'l' or 'p' (timer)
+std::string path;
+
+// stream rates [Hz] (0 disables a stream)
+double imuRate;
+double wheelRate;
+double lidarRate;
+
+// run length and its unmeasured start [s]
+double duration;
+double settleTime;
+
+// raw latencies, one line per matched input ("" disables it)
+std::string csvFile;
+
+//-----------------------------
+// Latency harness class
+//-----------------------------
+// Publishes stamped "<ns>/imu", "<ns>/odom" and "<ns>/odom_rf2o" at fixed
+// rates on a dedicated thread and subscribes to
+// "<ns>/ekf_loam/filter_odom_to_init". The latency of an input is the time
+// from its stamp (its send time) to the arrival of the first output stamped
+// at or after it, the first output that can contain it: on the paths 'i',
+// 'w' and 'l' the output carries the stamp of the triggering input, on the
+// timer path 'p' the start of the step (an input in flight at that instant
+// is then credited one step early). Reported per input stream.
+class LatencyHarness : public rclcpp::Node {
+
+private:
+    static const int N_STREAMS = 3;   // imu, wheel, lidar
+
+    // Publisher
+    rclcpp::Publisher<sensor_msgs::msg::Imu>::SharedPtr pubImu;
+    rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr pubWheelOdometry;
+    rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr pubLaserOdometry;
+
+    // Subscriber
+    rclcpp::Subscription<nav_msgs::msg::Odometry>::SharedPtr subFilteredOdometry;
+
+    // messages, sender thread only
+    sensor_msgs::msg::Imu imu;
+    nav_msgs::msg::Odometry wheelOdometry;
+    nav_msgs::msg::Odometry laserOdometry;
+
+    std::thread sender;
+    std::atomic<bool> running;
+    double t0;
+
+    // inputs waiting for an output, and the matched ones
+    std::mutex statsMtx;
+    bool measuring;
+    std::deque<double> pending[N_STREAMS];       // [s] stamps
+    std::vector<double> latencies[N_STREAMS];    // [s]
+    std::vector<double> matchedStamps[N_STREAMS];
+    uint64_t sent[N_STREAMS];
+    uint64_t outputs;
+
+public:
+    LatencyHarness(const std::string &node_name, const rclcpp::NodeOptions &options)
+        : Node(node_name, options), running(true), measuring(false), outputs(0) {
+        rclcpp::QoS qos(depth);
+        if (reliability == "best_effort"){
+            qos.best_effort();
+        }
+
+        // Publisher
+        pubImu = this->create_publisher<sensor_msgs::msg::Imu>(ns + "/imu", qos);
+        pubWheelOdometry = this->create_publisher<nav_msgs::msg::Odometry>(ns + "/odom", qos);
+        pubLaserOdometry = this->create_publisher<nav_msgs::msg::Odometry>(ns + "/odom_rf2o", qos);
+
+        // Subscriber
+        subFilteredOdometry = this->create_subscription<nav_msgs::msg::Odometry>(
+            ns + "/ekf_loam/filter_odom_to_init", qos, std::bind(&LatencyHarness::outputHandler, this, std::placeholders::_1));
+
+        imu.header.frame_id = "imu_link";
+        wheelOdometry.header.frame_id = "odom";
+        wheelOdometry.child_frame_id = "base_link";
+        laserOdometry.header.frame_id = "chassis_init";
+        laserOdometry.child_frame_id = "laser_odom";
+
+        for (int i = 0; i < N_STREAMS; i++){
+            latencies[i].reserve(1 << 16);
+            matchedStamps[i].reserve(1 << 16);
+            sent[i] = 0;
+        }
+        t0 = this->get_clock()->now().seconds();
+    }
+
+    ~LatencyHarness() {
+        running = false;
+        if (sender.joinable()){
+            sender.join();
+        }
+    }
+
+    // after the filter is active and the executor is set up
+    void start() {
+        sender = std::thread(&LatencyHarness::run, this);
+    }
+
+private:
+    //----------
+    // callbacks
+    //----------
+    void outputHandler(const nav_msgs::msg::Odometry::SharedPtr msg) {
+        double now = this->get_clock()->now().seconds();
+        double stamp = rclcpp::Time(msg->header.stamp).seconds();
+
+        std::lock_guard<std::mutex> lock(statsMtx);
+        if (!measuring){
+            return;
+        }
+        outputs++;
+        for (int i = 0; i < N_STREAMS; i++){
+            while (!pending[i].empty() && pending[i].front() <= stamp){
+                latencies[i].push_back(now - pending[i].front());
+                matchedStamps[i].push_back(pending[i].front());
+                pending[i].pop_front();
+            }
+        }
+    }
+
+    //----------
+    // sender
+    //----------
+    void run() {
+        const double rates[N_STREAMS] = {imuRate, wheelRate, lidarRate};
+        auto start = std::chrono::steady_clock::now();
+        auto settleEnd = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(settleTime));
+        auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(duration));
+
+        std::chrono::steady_clock::duration periods[N_STREAMS];
+        std::chrono::steady_clock::time_point next[N_STREAMS];
+        for (int i = 0; i < N_STREAMS; i++){
+            periods[i] = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(rates[i] > 0 ? 1.0/rates[i] : 0));
+            next[i] = start;
+        }
+
+        bool settled = false;
+        while (running && rclcpp::ok()){
+            // next message due among the streams
+            int k = -1;
+            for (int i = 0; i < N_STREAMS; i++){
+                if (rates[i] > 0 && (k < 0 || next[i] < next[k])){
+                    k = i;
+                }
+            }
+            auto due = k >= 0 ? std::min(next[k], end) : end;
+            if (!settled && due >= settleEnd){
+                std::this_thread::sleep_until(settleEnd);
+                std::lock_guard<std::mutex> lock(statsMtx);
+                measuring = true;
+                settled = true;
+            }
+            if (due >= end){
+                std::this_thread::sleep_until(end);
+                break;
+            }
+
+            std::this_thread::sleep_until(due);
+            send(k);
+            next[k] += periods[k];
+        }
+
+        // let the last outputs arrive
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        report();
+        rclcpp::shutdown();
+    }
+
+    void send(int k) {
+        rclcpp::Time now = this->get_clock()->now();
+        {
+            std::lock_guard<std::mutex> lock(statsMtx);
+            if (measuring){
+                pending[k].push_back(now.seconds());
+                sent[k]++;
+            }
+        }
+
+        // noise-free circle of radius 5 m at 1 m/s, heading along x
+        double t = now.seconds() - t0;
+        double w = 0.2;
+        double yaw = w*t;
+
+        tf2::Quaternion q;
+        switch (k) {
+            case 0:
+                imu.header.stamp = now;
+                q.setRPY(0, 0, yaw);
+                imu.orientation = tf2::toMsg(q);
+                imu.angular_velocity.z = w;
+                imu.linear_acceleration.y = w;
+                imu.linear_acceleration.z = 9.81;
+                for (int i = 0; i < 3; i++){
+                    imu.orientation_covariance[4*i] = 1e-4;
+                    imu.angular_velocity_covariance[4*i] = 1e-4;
+                    imu.linear_acceleration_covariance[4*i] = 2.5e-3;
+                }
+                pubImu->publish(imu);
+                break;
+            case 1:
+                wheelOdometry.header.stamp = now;
+                wheelOdometry.twist.twist.linear.x = 1.0;
+                wheelOdometry.twist.twist.angular.z = w;
+                wheelOdometry.twist.covariance[0] = 4e-4;
+                wheelOdometry.twist.covariance[35] = 4e-4;
+                pubWheelOdometry->publish(wheelOdometry);
+                break;
+            default:
+                laserOdometry.header.stamp = now;
+                laserOdometry.pose.pose.position.x = 5.0*std::sin(yaw);
+                laserOdometry.pose.pose.position.y = 5.0*(1 - std::cos(yaw));
+                q.setRPY(0, 0, yaw);
+                laserOdometry.pose.pose.orientation = tf2::toMsg(q);
+                // feature counts of the adaptive covariance
+                laserOdometry.twist.twist.linear.x = 400;
+                laserOdometry.twist.twist.angular.x = 4000;
+                pubLaserOdometry->publish(laserOdometry);
+        }
+    }
+
+    //----------
+    // report
+    //----------
+    void report() {
+        static const char *names[N_STREAMS] = {"imu", "wheel", "lidar"};
+        double now = this->get_clock()->now().seconds();
+        double span = std::max(duration - settleTime, 1e-3);
+
+        std::lock_guard<std::mutex> lock(statsMtx);
+        measuring = false;
+
+        RCLCPP_INFO(this->get_logger(), "path '%s', %s executor%s, %s filter%s, %s depth %d: %.0f outputs/s",
+                    path.c_str(), executorType.c_str(), executorType == "multi" ? (" (" + std::to_string(threads) + " threads)").c_str() : "",
+                    inProcess ? "in-process" : "external", inProcess && intraProcess ? " (intra-process)" : "",
+                    reliability.c_str(), depth, outputs/span);
+        RCLCPP_INFO(this->get_logger(), "input    sent  matched  unmatched  latency mean/p50/p90/p99/p99.9/max [ms]");
+
+        for (int i = 0; i < N_STREAMS; i++){
+            if (sent[i] == 0){
+                continue;
+            }
+            // still waiting after 1 s: no output will contain them
+            uint64_t unmatched = std::count_if(pending[i].begin(), pending[i].end(), [now](double stamp) { return now - stamp > 1.0; });
+
+            std::vector<double> lat = latencies[i];
+            double mean = 0, p[5] = {0, 0, 0, 0, 0};
+            if (!lat.empty()){
+                std::sort(lat.begin(), lat.end());
+                const double q[4] = {0.5, 0.9, 0.99, 0.999};
+                for (double l : lat){
+                    mean += l;
+                }
+                mean /= lat.size();
+                for (int j = 0; j < 4; j++){
+                    p[j] = lat[std::min(lat.size() - 1, static_cast<size_t>(q[j]*lat.size()))];
+                }
+                p[4] = lat.back();
+            }
+
+            RCLCPP_INFO(this->get_logger(), "%-6s %6lu  %7zu  %9lu  %6.2f/%6.2f/%6.2f/%6.2f/%6.2f/%6.2f",
+                        names[i], static_cast<unsigned long>(sent[i]), lat.size(), static_cast<unsigned long>(unmatched),
+                        1e3*mean, 1e3*p[0], 1e3*p[1], 1e3*p[2], 1e3*p[3], 1e3*p[4]);
+        }
+
+        if (!csvFile.empty()){
+            FILE *csv = std::fopen(csvFile.c_str(), "w");
+            if (!csv){
+                RCLCPP_WARN(this->get_logger(), "Could not write %s.", csvFile.c_str());
+                return;
+            }
+            std::fprintf(csv, "input,stamp_ns,latency_ns,path,executor,reliability,depth\n");
+            for (int i = 0; i < N_STREAMS; i++){
+                for (size_t j = 0; j < latencies[i].size(); j++){
+                    std::fprintf(csv, "%s,%lld,%lld,%s,%s,%s,%d\n", names[i],
+                                 static_cast<long long>(std::llround(matchedStamps[i][j]*1e9)), static_cast<long long>(std::llround(latencies[i][j]*1e9)),
+                                 path.c_str(), executorType.c_str(), reliability.c_str(), depth);
+                }
+            }
+            std::fclose(csv);
+        }
+    }
+};
+
+
+//-----------------------------
+// Main
+//-----------------------------
+int main(int argc, char** argv) {
+    rclcpp::init(argc, argv);
+
+    //Parameters init:
+    auto nh_ = rclcpp::Node::make_shared("adaptive_filter_latency_params");
+    try {
+        nh_->declare_parameter("/latency_harness/namespace", std::string(""));
+
+        nh_->declare_parameter("/latency_harness/inProcess", true);
+        nh_->declare_parameter("/latency_harness/intraProcess", false);
+        nh_->declare_parameter("/latency_harness/executor", std::string("single"));
+        nh_->declare_parameter("/latency_harness/threads", 0);
+
+        nh_->declare_parameter("/latency_harness/reliability", std::string("reliable"));
+        nh_->declare_parameter("/latency_harness/depth", 5);
+
+        nh_->declare_parameter("/latency_harness/path", std::string("l"));
+        nh_->declare_parameter("/latency_harness/imuRate", 100.0);
+        nh_->declare_parameter("/latency_harness/wheelRate", 20.0);
+        nh_->declare_parameter("/latency_harness/lidarRate", 10.0);
+
+        nh_->declare_parameter("/latency_harness/duration", 30.0);
+        nh_->declare_parameter("/latency_harness/settleTime", 3.0);
+        nh_->declare_parameter("/latency_harness/csvFile", std::string(""));
+
+        nh_->get_parameter("/latency_harness/namespace", ns);
+
+        nh_->get_parameter("/latency_harness/inProcess", inProcess);
+        nh_->get_parameter("/latency_harness/intraProcess", intraProcess);
+        nh_->get_parameter("/latency_harness/executor", executorType);
+        nh_->get_parameter("/latency_harness/threads", threads);
+
+        nh_->get_parameter("/latency_harness/reliability", reliability);
+        nh_->get_parameter("/latency_harness/depth", depth);
+
+        nh_->get_parameter("/latency_harness/path", path);
+        nh_->get_parameter("/latency_harness/imuRate", imuRate);
+        nh_->get_parameter("/latency_harness/wheelRate", wheelRate);
+        nh_->get_parameter("/latency_harness/lidarRate", lidarRate);
+
+        nh_->get_parameter("/latency_harness/duration", duration);
+        nh_->get_parameter("/latency_harness/settleTime", settleTime);
+        nh_->get_parameter("/latency_harness/csvFile", csvFile);
+    } catch (int e) {
+        RCLCPP_INFO(nh_->get_logger(), "Exception occurred when importing parameters in Latency Harness Node. Exception Nr. %d", e);
+    }
+    nh_.reset();
+
+    // the output path needs its input stream (the timer path none)
+    const double rates[] = {imuRate, wheelRate, lidarRate};
+    size_t stream = path.size() == 1 ? std::string("iwl").find(path[0]) : std::string::npos;
+    if (path != "p" && (stream == std::string::npos || rates[stream] <= 0)){
+        RCLCPP_ERROR(rclcpp::get_logger("adaptive_filter_latency_harness"),
+                     stream == std::string::npos ? "Unknown path '%s', expected 'i', 'w', 'l' or 'p'." : "Path '%s' needs its input stream, whose rate is 0.",
+                     path.c_str());
+        rclcpp::shutdown();
+        return 1;
+    }
+    if (!inProcess){
+        RCLCPP_WARN(rclcpp::get_logger("adaptive_filter_latency_harness"),
+                    "Measuring a running filter: it must have filterFreq '%s' and the inputs of the path enabled.", path.c_str());
+    }
+
+    depth = std::max(depth, 1);
+    threads = std::max(threads, 0);
+    settleTime = std::min(std::max(settleTime, 0.0), 0.9*duration);
+
+    std::unique_ptr<rclcpp::Executor> executor;
+    if (executorType == "multi"){
+        executor = std::make_unique<rclcpp::executors::MultiThreadedExecutor>(rclcpp::ExecutorOptions(), threads);
+        threads = static_cast<int>(static_cast<rclcpp::executors::MultiThreadedExecutor*>(executor.get())->get_number_of_threads());
+    } else if (executorType == "static"){
+        executor = std::make_unique<rclcpp::executors::StaticSingleThreadedExecutor>();
+    } else {
+        executorType = "single";
+        executor = std::make_unique<rclcpp::executors::SingleThreadedExecutor>();
+    }
+
+    // the filter with the harness settings over the parameter file
+    std::shared_ptr<rclcpp_lifecycle::LifecycleNode> filter;
+    if (inProcess){
+        rclcpp::NodeOptions options;
+        options.use_intra_process_comms(intraProcess);
+        options.parameter_overrides({
+            rclcpp::Parameter("/adaptive_filter/filterFreq", path),
+            rclcpp::Parameter("/adaptive_filter/outputRate", 0.0),
+            rclcpp::Parameter("/adaptive_filter/sensorQos", reliability),
+            // the filter uses exactly the streams sent
+            rclcpp::Parameter("/adaptive_filter/enableImu", imuRate > 0),
+            rclcpp::Parameter("/adaptive_filter/enableWheel", wheelRate > 0),
+            rclcpp::Parameter("/adaptive_filter/enableLidar", lidarRate > 0),
+        });
+        filter = make_adaptive_filter(options);
+        filter->configure();
+        filter->activate();
+        executor->add_node(filter->get_node_base_interface());
+    }
+
+    auto harness = std::make_shared<LatencyHarness>("adaptive_filter_latency_harness",
+                                                    rclcpp::NodeOptions().use_intra_process_comms(inProcess && intraProcess));
+    executor->add_node(harness);
+    harness->start();
+
+    executor->spin();
+    rclcpp::shutdown();
+    return 0;
+}
@@ -0,0 +1,462 @@
+#include <rclcpp/rclcpp.hpp>
+#include <std_msgs/msg/header.hpp>
+#include <sensor_msgs/msg/imu.hpp>
+#include <nav_msgs/msg/odometry.hpp>
+#include <tf2_geometry_msgs/tf2_geometry_msgs.h>
+#include <tf2/transform_datatypes.h>
+#include <adaptive_filter/msg/sensor_health.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//-----------------------------
+// Global variables
+//-----------------------------
+std::string ns;
+
+// stream rates [Hz] of the first load step
+double imuRate;
+double wheelRate;
+double lidarRate;
+
+// send time jitter (standard deviation, share of the period) and messages
+// sent back to back per burst (same average rate)
+double jitter;
+int burstSize;
+
+// load steps: rates multiplied by rampFactor every stepDuration seconds, the
+// first settleTime seconds of each step are not measured
+int rampSteps;
+double rampFactor;
+double stepDuration;
+double settleTime;
+
+// share of the sent messages the filter may miss at a sustainable step, and
+// its p99 output latency [s] (0: not judged)
+double dropTolerance;
+double maxLatency;
+
+// ground truth: circle of radius [m] at speed [m/s], measurement noise
+double radius;
+double speed;
+bool noise;
+
+//-----------------------------
+// Load generator class
+//-----------------------------
+// Publishes "<ns>/imu", "<ns>/odom" and "<ns>/odom_rf2o" from a circular
+// ground-truth trajectory on a dedicated thread (sleep_until per message, so
+// kHz rates do not depend on the executor) and raises the rates step by
+// step. Per step it reports the rates sent and processed by the filter (from
+// the totals of "<ns>/ekf_loam/sensor_health"), the drops (sent minus
+// processed, so transport, queue and overwritten-slot losses), the filter load
+// and the latency of "<ns>/ekf_loam/filter_odom_to_init" (arrival minus its
+// stamp, which follows the input stamps: run the filter with filterFreq set
+// to the stream of interest and outputRate 0).
+class LoadGenerator : public rclcpp::Node {
+
+private:
+    static const int N_STREAMS = 3;   // imu, wheel, lidar
+
+    // Publisher
+    rclcpp::Publisher<sensor_msgs::msg::Imu>::SharedPtr pubImu;
+    rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr pubWheelOdometry;
+    rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr pubLaserOdometry;
+
+    // Subscriber
+    rclcpp::Subscription<nav_msgs::msg::Odometry>::SharedPtr subFilteredOdometry;
+    rclcpp::Subscription<adaptive_filter::msg::SensorHealth>::SharedPtr subSensorHealth;
+
+    // messages, sender thread only
+    sensor_msgs::msg::Imu imu;
+    nav_msgs::msg::Odometry wheelOdometry;
+    nav_msgs::msg::Odometry laserOdometry;
+
+    struct Stream {
+        double period;                                 // [s]
+        std::chrono::steady_clock::time_point nominal; // of the next burst
+        std::chrono::steady_clock::time_point next;
+        int burst;                                     // sent in this burst
+        uint64_t sent;                                 // measured in this step
+    } streams[N_STREAMS];
+
+    std::thread sender;
+    std::atomic<bool> running;
+    std::mt19937 rng;
+    double t0;
+
+    // measurements of the current step, from the executor
+    std::mutex statsMtx;
+    bool measuring;
+    std::vector<double> latencies;
+    uint64_t outputs;
+    int healthCount;
+    double healthFirst, healthLast;        // [s] stamps
+    uint64_t totalFirst[N_STREAMS], totalLast[N_STREAMS];
+    double loadSum;
+    int loadCount;
+    double loadMax;
+    uint8_t loadModeMax;
+    double imuExpected;   // [Hz] of the filter
+
+public:
+    LoadGenerator(const std::string &node_name) : Node(node_name), running(true), rng(42), measuring(false) {
+        // Publisher
+        pubImu = this->create_publisher<sensor_msgs::msg::Imu>(ns + "/imu", 50);
+        pubWheelOdometry = this->create_publisher<nav_msgs::msg::Odometry>(ns + "/odom", 5);
+        pubLaserOdometry = this->create_publisher<nav_msgs::msg::Odometry>(ns + "/odom_rf2o", 5);
+
+        // Subscriber
+        subFilteredOdometry = this->create_subscription<nav_msgs::msg::Odometry>(
+            ns + "/ekf_loam/filter_odom_to_init", 50, std::bind(&LoadGenerator::outputHandler, this, std::placeholders::_1));
+        subSensorHealth = this->create_subscription<adaptive_filter::msg::SensorHealth>(
+            ns + "/ekf_loam/sensor_health", 5, std::bind(&LoadGenerator::healthHandler, this, std::placeholders::_1));
+
+        imu.header.frame_id = "imu_link";
+        wheelOdometry.header.frame_id = "odom";
+        wheelOdometry.child_frame_id = "base_link";
+        laserOdometry.header.frame_id = "chassis_init";
+        laserOdometry.child_frame_id = "laser_odom";
+
+        latencies.reserve(1 << 16);
+        t0 = this->get_clock()->now().seconds();
+        sender = std::thread(&LoadGenerator::run, this);
+    }
+
+    ~LoadGenerator() {
+        running = false;
+        if (sender.joinable()){
+            sender.join();
+        }
+    }
+
+private:
+    //----------
+    // callbacks
+    //----------
+    void outputHandler(const nav_msgs::msg::Odometry::SharedPtr msg) {
+        double latency = this->get_clock()->now().seconds() - rclcpp::Time(msg->header.stamp).seconds();
+
+        std::lock_guard<std::mutex> lock(statsMtx);
+        if (measuring){
+            latencies.push_back(latency);
+            outputs++;
+        }
+    }
+
+    void healthHandler(const adaptive_filter::msg::SensorHealth::SharedPtr msg) {
+        std::lock_guard<std::mutex> lock(statsMtx);
+        if (!measuring){
+            return;
+        }
+        if (msg->sensors.size() < N_STREAMS){
+            return;
+        }
+
+        // processed rates from the totals of the first and last summary
+        healthLast = rclcpp::Time(msg->stamp).seconds();
+        for (int i = 0; i < N_STREAMS; i++){
+            totalLast[i] = msg->sensors[i].total_processed;
+        }
+        if (healthCount++ == 0){
+            healthFirst = healthLast;
+            std::copy(totalLast, totalLast + N_STREAMS, totalFirst);
+        }
+        loadSum += msg->load;
+        loadCount++;
+        loadMax = std::max(loadMax, msg->load);
+        imuExpected = msg->sensors[0].expected_rate;
+        loadModeMax = std::max(loadModeMax, msg->load_mode);
+    }
+
+    //----------
+    // sender
+    //----------
+    void run() {
+        const double baseRates[N_STREAMS] = {imuRate, wheelRate, lidarRate};
+        static const char *names[N_STREAMS] = {"imu", "wheel", "lidar"};
+        int ceiling = -1;
+
+        RCLCPP_INFO(this->get_logger(), "step  rate imu/wheel/lidar [Hz]  processed [Hz]       drops [%%]          outputs [Hz]  latency p50/p90/p99/max [ms]  load");
+
+        for (int step = 0; step < rampSteps && running && rclcpp::ok(); step++){
+            double scale = std::pow(rampFactor, step);
+            auto stepStart = std::chrono::steady_clock::now();
+            for (int i = 0; i < N_STREAMS; i++){
+                double rate = baseRates[i]*scale;
+                streams[i].period = rate > 0 ? 1.0/rate : 0;
+                streams[i].nominal = stepStart;
+                streams[i].next = stepStart;
+                streams[i].burst = 0;
+                streams[i].sent = 0;
+            }
+
+            auto settleEnd = stepStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(settleTime));
+            auto stepEnd = stepStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(stepDuration));
+            bool settled = false;
+
+            while (running && rclcpp::ok()){
+                // next message due among the streams
+                int k = -1;
+                for (int i = 0; i < N_STREAMS; i++){
+                    if (streams[i].period > 0 && (k < 0 || streams[i].next < streams[k].next)){
+                        k = i;
+                    }
+                }
+                auto due = k >= 0 ? std::min(streams[k].next, stepEnd) : stepEnd;
+                if (!settled && due >= settleEnd){
+                    std::this_thread::sleep_until(settleEnd);
+                    start_measurement();
+                    settled = true;
+                    for (int i = 0; i < N_STREAMS; i++){
+                        streams[i].sent = 0;
+                    }
+                }
+                if (due >= stepEnd){
+                    std::this_thread::sleep_until(stepEnd);
+                    break;
+                }
+
+                std::this_thread::sleep_until(due);
+                send(k);
+                streams[k].sent++;
+                schedule(streams[k]);
+            }
+
+            // step report
+            double span = std::max(stepDuration - settleTime, 1e-3);
+            double sent[N_STREAMS], got[N_STREAMS], dropRatio = 0;
+            std::vector<double> lat;
+            uint64_t out;
+            double load, peak, expected;
+            uint8_t mode;
+            {
+                std::lock_guard<std::mutex> lock(statsMtx);
+                measuring = false;
+                double healthSpan = healthLast - healthFirst;
+                for (int i = 0; i < N_STREAMS; i++){
+                    sent[i] = streams[i].sent/span;
+                    got[i] = healthCount > 1 && healthSpan > 0 ? (totalLast[i] - totalFirst[i])/healthSpan : 0;
+                    if (sent[i] > 0){
+                        dropRatio = std::max(dropRatio, 1.0 - std::min(1.0, got[i]/sent[i]));
+                    }
+                }
+                lat.swap(latencies);
+                out = outputs;
+                load = loadCount > 0 ? loadSum/loadCount : 0;
+                peak = loadMax;
+                mode = loadModeMax;
+                expected = imuExpected;
+            }
+            latencies.reserve(lat.capacity());
+
+            double p[4] = {0, 0, 0, 0};
+            if (!lat.empty()){
+                std::sort(lat.begin(), lat.end());
+                const double q[3] = {0.5, 0.9, 0.99};
+                for (int j = 0; j < 3; j++){
+                    p[j] = lat[std::min(lat.size() - 1, static_cast<size_t>(q[j]*lat.size()))];
+                }
+                p[3] = lat.back();
+            }
+
+            RCLCPP_INFO(this->get_logger(), "%4d  %7.0f/%5.0f/%5.0f  %7.0f/%5.0f/%5.0f  %5.1f/%5.1f/%5.1f  %8.0f      %6.2f/%6.2f/%6.2f/%6.2f      %3.0f%% %s",
+                        step, sent[0], sent[1], sent[2], got[0], got[1], got[2],
+                        100*(1 - (sent[0] > 0 ? std::min(1.0, got[0]/sent[0]) : 1)),
+                        100*(1 - (sent[1] > 0 ? std::min(1.0, got[1]/sent[1]) : 1)),
+                        100*(1 - (sent[2] > 0 ? std::min(1.0, got[2]/sent[2]) : 1)),
+                        out/span, 1e3*p[0], 1e3*p[1], 1e3*p[2], 1e3*p[3], 100*load,
+                        mode == adaptive_filter::msg::SensorHealth::OVERLOADED ? "overloaded" :
+                        mode == adaptive_filter::msg::SensorHealth::DEGRADED ? "degraded" : "normal");
+
+            // the filter's IMU intake per step and rate alarm follow imuExpectedRate
+            double imuSent = baseRates[0]*scale;
+            if (expected > 0 && imuSent > 0 && std::abs(expected - imuSent) > 0.1*imuSent){
+                RCLCPP_WARN(this->get_logger(), "Filter imuExpectedRate %.0f Hz differs from the generated %.0f Hz: its backlog and rate alarm misjudge this step.",
+                            expected, imuSent);
+            }
+
+            // the ceiling is the last step of the sustained run from the first:
+            // drops within tolerance, every step fit in its period (positive
+            // slack) and the latency bound held; the load mode is only reported,
+            // since it follows the shedding thresholds, not the compute limit
+            bool fits = loadCount > 0 && peak < 1.0;
+            bool timely = maxLatency <= 0 || lat.empty() || p[2] <= maxLatency;
+            if (ceiling == step - 1 && dropRatio <= dropTolerance && fits && timely){
+                ceiling = step;
+            }
+        }
+
+        if (ceiling >= 0){
+            double scale = std::pow(rampFactor, ceiling);
+            RCLCPP_INFO(this->get_logger(), "Sustained up to step %d: %s %.0f Hz, %s %.0f Hz, %s %.0f Hz (drops within %.1f%%, load below 100%%).",
+                        ceiling, names[0], imuRate*scale, names[1], wheelRate*scale, names[2], lidarRate*scale, 100*dropTolerance);
+        } else {
+            RCLCPP_WARN(this->get_logger(), "No load step was sustained (is the filter running on %s?).", ns.empty() ? "/" : ns.c_str());
+        }
+        rclcpp::shutdown();
+    }
+
+    void start_measurement() {
+        std::lock_guard<std::mutex> lock(statsMtx);
+        measuring = true;
+        latencies.clear();
+        outputs = 0;
+        healthCount = 0;
+        healthFirst = healthLast = 0;
+        loadSum = 0;
+        loadCount = 0;
+        loadMax = 0;
+        loadModeMax = 0;
+        imuExpected = 0;
+    }
+
+    // bursts of burstSize messages every burstSize periods, each burst
+    // displaced by the jitter
+    void schedule(Stream &s) {
+        if (++s.burst < burstSize){
+            return;
+        }
+        s.burst = 0;
+
+        auto period = std::chrono::duration<double>(burstSize*s.period);
+        s.nominal += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+        s.next = s.nominal;
+        if (jitter > 0){
+            std::normal_distribution<double> offset(0.0, jitter*s.period);
+            s.next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(offset(rng)));
+        }
+    }
+
+    //----------
+    // ground truth
+    //----------
+    double gauss(double sigma) {
+        if (!noise){
+            return 0;
+        }
+        std::normal_distribution<double> n(0.0, sigma);
+        return n(rng);
+    }
+
+    void send(int k) {
+        rclcpp::Time now = this->get_clock()->now();
+        double t = now.seconds() - t0;
+
+        // circle from the origin, heading along x
+        double w = speed/radius;
+        double yaw = w*t;
+        double x = radius*std::sin(yaw);
+        double y = radius*(1 - std::cos(yaw));
+
+        tf2::Quaternion q;
+        switch (k) {
+            case 0:
+                imu.header.stamp = now;
+                q.setRPY(gauss(0.01), gauss(0.01), yaw + gauss(0.01));
+                imu.orientation = tf2::toMsg(q);
+                imu.angular_velocity.x = gauss(0.01);
+                imu.angular_velocity.y = gauss(0.01);
+                imu.angular_velocity.z = w + gauss(0.01);
+                imu.linear_acceleration.x = gauss(0.05);
+                imu.linear_acceleration.y = speed*w + gauss(0.05);
+                imu.linear_acceleration.z = 9.81 + gauss(0.05);
+                for (int i = 0; i < 3; i++){
+                    imu.orientation_covariance[4*i] = 1e-4;
+                    imu.angular_velocity_covariance[4*i] = 1e-4;
+                    imu.linear_acceleration_covariance[4*i] = 2.5e-3;
+                }
+                pubImu->publish(imu);
+                break;
+            case 1:
+                wheelOdometry.header.stamp = now;
+                wheelOdometry.twist.twist.linear.x = speed + gauss(0.02);
+                wheelOdometry.twist.twist.angular.z = w + gauss(0.02);
+                wheelOdometry.twist.covariance[0] = 4e-4;
+                wheelOdometry.twist.covariance[35] = 4e-4;
+                pubWheelOdometry->publish(wheelOdometry);
+                break;
+            default:
+                laserOdometry.header.stamp = now;
+                laserOdometry.pose.pose.position.x = x + gauss(0.01);
+                laserOdometry.pose.pose.position.y = y + gauss(0.01);
+                laserOdometry.pose.pose.position.z = gauss(0.01);
+                q.setRPY(gauss(0.005), gauss(0.005), yaw + gauss(0.005));
+                laserOdometry.pose.pose.orientation = tf2::toMsg(q);
+                // feature counts of the adaptive covariance
+                laserOdometry.twist.twist.linear.x = 400;
+                laserOdometry.twist.twist.angular.x = 4000;
+                pubLaserOdometry->publish(laserOdometry);
+        }
+    }
+};
+
+
+//-----------------------------
+// Main
+//-----------------------------
+int main(int argc, char** argv) {
+    rclcpp::init(argc, argv);
+
+    //Parameters init:
+    auto nh_ = rclcpp::Node::make_shared("adaptive_filter_load_params");
+    try {
+        nh_->declare_parameter("/load_generator/namespace", std::string(""));
+
+        nh_->declare_parameter("/load_generator/imuRate", 100.0);
+        nh_->declare_parameter("/load_generator/wheelRate", 20.0);
+        nh_->declare_parameter("/load_generator/lidarRate", 10.0);
+
+        nh_->declare_parameter("/load_generator/jitter", 0.0);
+        nh_->declare_parameter("/load_generator/burstSize", 1);
+
+        nh_->declare_parameter("/load_generator/rampSteps", 8);
+        nh_->declare_parameter("/load_generator/rampFactor", 2.0);
+        nh_->declare_parameter("/load_generator/stepDuration", 10.0);
+        nh_->declare_parameter("/load_generator/settleTime", 2.0);
+        nh_->declare_parameter("/load_generator/dropTolerance", 0.01);
+        nh_->declare_parameter("/load_generator/maxLatency", 0.05);
+
+        nh_->declare_parameter("/load_generator/radius", 5.0);
+        nh_->declare_parameter("/load_generator/speed", 1.0);
+        nh_->declare_parameter("/load_generator/noise", true);
+
+        nh_->get_parameter("/load_generator/namespace", ns);
+
+        nh_->get_parameter("/load_generator/imuRate", imuRate);
+        nh_->get_parameter("/load_generator/wheelRate", wheelRate);
+        nh_->get_parameter("/load_generator/lidarRate", lidarRate);
+
+        nh_->get_parameter("/load_generator/jitter", jitter);
+        nh_->get_parameter("/load_generator/burstSize", burstSize);
+
+        nh_->get_parameter("/load_generator/rampSteps", rampSteps);
+        nh_->get_parameter("/load_generator/rampFactor", rampFactor);
+        nh_->get_parameter("/load_generator/stepDuration", stepDuration);
+        nh_->get_parameter("/load_generator/settleTime", settleTime);
+        nh_->get_parameter("/load_generator/dropTolerance", dropTolerance);
+        nh_->get_parameter("/load_generator/maxLatency", maxLatency);
+
+        nh_->get_parameter("/load_generator/radius", radius);
+        nh_->get_parameter("/load_generator/speed", speed);
+        nh_->get_parameter("/load_generator/noise", noise);
+    } catch (int e) {
+        RCLCPP_INFO(nh_->get_logger(), "Exception occurred when importing parameters in Load Generator Node. Exception Nr. %d", e);
+    }
+    burstSize = std::max(burstSize, 1);
+    radius = std::max(radius, 0.1);
+    settleTime = std::min(std::max(settleTime, 0.0), 0.9*stepDuration);
+
+    auto generator = std::make_shared<LoadGenerator>("adaptive_filter_load_generator");
+
+    rclcpp::spin(generator);
+    rclcpp::shutdown();
+    return 0;
+}
@@ -0,0 +1,292 @@
+#include <adaptive_filter/Metrics.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Registry
+//-----------------------------
+static std::atomic<int> threadCount(0);
+
+static uint64_t to_bits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double from_bits(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+MetricsRegistry::MetricsRegistry()
+    : cells(0), shards(new Shard[MAX_SHARDS]), gauges(new std::atomic<uint64_t>[MAX_CELLS]) {
+    clear();
+}
+
+void MetricsRegistry::clear() {
+    series.clear();
+    cells = 0;
+    for (int s = 0; s < MAX_SHARDS; s++){
+        for (int c = 0; c < MAX_CELLS; c++){
+            shards[s].cells[c].store(0, std::memory_order_relaxed);
+        }
+    }
+    for (int c = 0; c < MAX_CELLS; c++){
+        gauges[c].store(to_bits(0.0), std::memory_order_relaxed);
+    }
+}
+
+// shard of the calling thread, by its index among the threads that updated
+// any registry
+MetricsRegistry::Shard &MetricsRegistry::local() {
+    static thread_local int index = threadCount.fetch_add(1, std::memory_order_relaxed);
+    return shards[index % MAX_SHARDS];
+}
+
+int MetricsRegistry::counter(const std::string &name, const std::string &help, const std::string &labels) {
+    if (cells + 1 > MAX_CELLS){
+        return -1;
+    }
+    series.push_back(Series{COUNTER, name, help, labels, cells, {}, 1});
+    cells += 1;
+    return static_cast<int>(series.size()) - 1;
+}
+
+int MetricsRegistry::gauge(const std::string &name, const std::string &help, const std::string &labels) {
+    if (series.size() >= static_cast<size_t>(MAX_CELLS)){
+        return -1;
+    }
+    series.push_back(Series{GAUGE, name, help, labels, -1, {}, 1});
+    return static_cast<int>(series.size()) - 1;
+}
+
+int MetricsRegistry::histogram(const std::string &name, const std::string &help, const std::string &labels,
+                               const std::vector<double> &bounds, double scale) {
+    // a count per bucket, +Inf and the sum
+    int n = static_cast<int>(bounds.size()) + 2;
+    if (cells + n > MAX_CELLS){
+        return -1;
+    }
+    series.push_back(Series{HISTOGRAM, name, help, labels, cells, bounds, scale});
+    cells += n;
+    return static_cast<int>(series.size()) - 1;
+}
+
+void MetricsRegistry::set(int gauge_id, double value) {
+    if (gauge_id < 0) return;
+    gauges[gauge_id].store(to_bits(value), std::memory_order_relaxed);
+}
+
+void MetricsRegistry::observe(int histogram_id, double value) {
+    if (histogram_id < 0) return;
+    const Series &h = series[histogram_id];
+    size_t b = std::lower_bound(h.bounds.begin(), h.bounds.end(), value) - h.bounds.begin();
+
+    Shard &shard = local();
+    shard.cells[h.cell + b].fetch_add(1, std::memory_order_relaxed);
+    if (value > 0){
+        shard.cells[h.cell + h.bounds.size() + 1].fetch_add(static_cast<uint64_t>(std::llround(value*h.scale)), std::memory_order_relaxed);
+    }
+}
+
+static void append_sample(std::string &out, const std::string &name, const std::string &labels, const char *extra, double value) {
+    char buffer[64];
+    out += name;
+    if (!labels.empty() || extra){
+        out += '{';
+        out += labels;
+        if (extra){
+            if (!labels.empty()) out += ',';
+            out += extra;
+        }
+        out += '}';
+    }
+    std::snprintf(buffer, sizeof(buffer), " %.17g\n", value);
+    out += buffer;
+}
+
+std::string MetricsRegistry::render() const {
+    static const char *types[] = {"counter", "gauge", "histogram"};
+    std::string out;
+    out.reserve(64*series.size());
+
+    auto sum = [this](int cell) {
+        uint64_t total = 0;
+        for (int s = 0; s < MAX_SHARDS; s++){
+            total += shards[s].cells[cell].load(std::memory_order_relaxed);
+        }
+        return total;
+    };
+
+    for (size_t i = 0; i < series.size(); i++){
+        const Series &m = series[i];
+        if (i == 0 || series[i - 1].name != m.name){
+            out += "# HELP " + m.name + " " + m.help + "\n";
+            out += "# TYPE " + m.name + " " + types[m.kind] + "\n";
+        }
+
+        switch (m.kind) {
+            case COUNTER:
+                append_sample(out, m.name, m.labels, nullptr, static_cast<double>(sum(m.cell)));
+                break;
+            case GAUGE:
+                append_sample(out, m.name, m.labels, nullptr, from_bits(gauges[i].load(std::memory_order_relaxed)));
+                break;
+            case HISTOGRAM: {
+                char le[48];
+                uint64_t count = 0;
+                for (size_t b = 0; b <= m.bounds.size(); b++){
+                    count += sum(m.cell + b);
+                    if (b < m.bounds.size()){
+                        std::snprintf(le, sizeof(le), "le=\"%g\"", m.bounds[b]);
+                    } else {
+                        std::snprintf(le, sizeof(le), "le=\"+Inf\"");
+                    }
+                    append_sample(out, m.name + "_bucket", m.labels, le, static_cast<double>(count));
+                }
+                append_sample(out, m.name + "_sum", m.labels, nullptr, sum(m.cell + m.bounds.size() + 1)/m.scale);
+                append_sample(out, m.name + "_count", m.labels, nullptr, static_cast<double>(count));
+                break;
+            }
+        }
+    }
+    return out;
+}
+
+//-----------------------------
+// Server
+//-----------------------------
+bool MetricsServer::start(const MetricsRegistry &metrics, const std::string &endpoint) {
+    stop();
+    registry = &metrics;
+
+    if (endpoint.compare(0, 5, "unix:") == 0){
+        std::string path = endpoint.substr(5);
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)){
+            return false;
+        }
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0){
+            return false;
+        }
+        unlink(path.c_str());
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0){
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        unixPath = path;
+    } else {
+        size_t colon = endpoint.rfind(':');
+        if (colon == std::string::npos){
+            return false;
+        }
+        std::string host = colon > 0 ? endpoint.substr(0, colon) : "127.0.0.1";
+        int port = std::atoi(endpoint.c_str() + colon + 1);
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        if (port <= 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1){
+            return false;
+        }
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0){
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0){
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+
+    if (listen(fd, 4) != 0){
+        stop();
+        return false;
+    }
+
+    stopping = false;
+    thread = std::thread(&MetricsServer::serve, this);
+    return true;
+}
+
+void MetricsServer::stop() {
+    stopping = true;
+    if (thread.joinable()){
+        thread.join();
+    }
+    if (fd >= 0){
+        ::close(fd);
+        fd = -1;
+    }
+    if (!unixPath.empty()){
+        unlink(unixPath.c_str());
+        unixPath.clear();
+    }
+}
+
+// one request per connection, polled so that stop() is noticed
+void MetricsServer::serve() {
+    while (!stopping){
+        pollfd listening = {fd, POLLIN, 0};
+        if (poll(&listening, 1, 200) <= 0){
+            continue;
+        }
+        int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0){
+            continue;
+        }
+
+        // the request itself is not interpreted, only waited for briefly
+        char request[1024];
+        pollfd reading = {client, POLLIN, 0};
+        if (poll(&reading, 1, 500) > 0){
+            ssize_t n = recv(client, request, sizeof(request), 0);
+            (void)n;
+        }
+
+        std::string body = registry->render();
+        char header[160];
+        int length = std::snprintf(header, sizeof(header),
+                                   "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                                   body.size());
+        std::string response(header, length);
+        response += body;
+
+        size_t sent = 0;
+        while (sent < response.size()){
+            ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0 && errno != EINTR){
+                break;
+            }
+            sent += n > 0 ? n : 0;
+        }
+        ::close(client);
+    }
+}
+
+}  // namespace adaptive_filter
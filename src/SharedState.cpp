@@ -0,0 +1,173 @@
+#include <adaptive_filter/SharedState.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace adaptive_filter {
+
+//-----------------------------
+// Writer
+//-----------------------------
+bool SharedStateWriter::open(const std::string &segment_name) {
+    close();
+
+    bool created = true;
+    int fd = shm_open(segment_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(segment_name.c_str(), O_RDWR, 0);
+    }
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (created ? ftruncate(fd, sizeof(SharedStateSegment)) != 0
+                : fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(SharedStateSegment))) {
+        if (created) {
+            shm_unlink(segment_name.c_str());
+        }
+        ::close(fd);
+        return false;
+    }
+
+    void *addr = mmap(nullptr, sizeof(SharedStateSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        if (created) {
+            shm_unlink(segment_name.c_str());
+        }
+        return false;
+    }
+    SharedStateSegment *s = static_cast<SharedStateSegment*>(addr);
+    const int32_t self = static_cast<int32_t>(getpid());
+
+    if (created) {
+        // a new segment starts from an even sequence with no state
+        s->owner.store(self, std::memory_order_relaxed);
+        s->seq.store(0, std::memory_order_relaxed);
+        std::memset(&s->state, 0, sizeof(s->state));
+        s->version = SharedStateSegment::VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        s->magic = SharedStateSegment::MAGIC;
+    } else {
+        // another version or a segment still being created is left alone; a
+        // live owner keeps it, a dead one's is claimed once
+        std::atomic_thread_fence(std::memory_order_acquire);
+        int32_t previous = s->owner.load(std::memory_order_relaxed);
+        if (s->magic != SharedStateSegment::MAGIC || s->version != SharedStateSegment::VERSION ||
+            previous == self || previous <= 0 || kill(previous, 0) == 0 || errno != ESRCH ||
+            !s->owner.compare_exchange_strong(previous, self)) {
+            munmap(addr, sizeof(SharedStateSegment));
+            return false;
+        }
+        // readers keep their mapping and the sequence continues; if the dead
+        // writer stopped in the middle of a write it stays odd until ours
+    }
+
+    segment = s;
+    name = segment_name;
+    return true;
+}
+
+void SharedStateWriter::close() {
+    if (!segment) {
+        return;
+    }
+    bool owner = segment->owner.load(std::memory_order_relaxed) == static_cast<int32_t>(getpid());
+    munmap(segment, sizeof(SharedStateSegment));
+    if (owner) {
+        shm_unlink(name.c_str());
+    }
+    segment = nullptr;
+}
+
+void SharedStateWriter::write(double stamp, const double *X, const double *P) {
+    if (!segment) {
+        return;
+    }
+
+    // odd already if a previous writer died mid-write
+    uint64_t seq = segment->seq.load(std::memory_order_relaxed) | 1;
+    segment->seq.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    segment->state.sequence = seq/2 + 1;
+    segment->state.stamp = stamp;
+    std::memcpy(segment->state.X, X, sizeof(segment->state.X));
+    std::memcpy(segment->state.P, P, sizeof(segment->state.P));
+
+    segment->seq.store(seq + 1, std::memory_order_release);
+}
+
+//-----------------------------
+// Reader
+//-----------------------------
+bool SharedStateReader::open(const std::string &segment_name) {
+    close();
+
+    int fd = shm_open(segment_name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(SharedStateSegment))) {
+        ::close(fd);
+        return false;
+    }
+
+    void *addr = mmap(nullptr, sizeof(SharedStateSegment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    segment = static_cast<const SharedStateSegment*>(addr);
+    if (segment->magic != SharedStateSegment::MAGIC || segment->version != SharedStateSegment::VERSION) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SharedStateReader::close() {
+    if (!segment) {
+        return;
+    }
+    munmap(const_cast<SharedStateSegment*>(segment), sizeof(SharedStateSegment));
+    segment = nullptr;
+}
+
+bool SharedStateReader::try_read(SharedStateSnapshot &out) const {
+    if (!segment) {
+        return false;
+    }
+
+    uint64_t seq0 = segment->seq.load(std::memory_order_acquire);
+    if (seq0 == 0 || (seq0 & 1)) {
+        return false;
+    }
+
+    std::memcpy(&out, &segment->state, sizeof(out));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t seq1 = segment->seq.load(std::memory_order_relaxed);
+    return seq0 == seq1;
+}
+
+bool SharedStateReader::read(SharedStateSnapshot &out, int max_attempts) const {
+    for (int i = 0; i < max_attempts; i++) {
+        if (try_read(out)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace adaptive_filter
@@ -0,0 +1,166 @@
+// Steady-state allocations of the filter. The test is built with
+// ADAPTIVE_FILTER_ALLOC_TRACKING and AllocTracker.cpp, which replace malloc
+// for the whole process, and drives the sensor handlers and the 200 Hz step
+// directly, inline and on a pool strand. After the warm-up no allocation may
+// be charged to the filter's own code: the step, its stages, the callbacks
+// (posting to the strand included) and the publisher thread, which runs for
+// a subscriber of the odometry: on the events of filterFreq inline, at
+// outputRate on the strand. Only the middleware calls themselves are left
+// out (ALLOC_OTHER), and the debug thread (logging) is not counted.
+#include <gtest/gtest.h>
+
+#include "../src/EKFAdaptiveFilter.cpp"
+
+class AdaptiveFilterTest : public ::testing::Test {
+
+protected:
+    static const int WARMUP = 400;    // cycles, 2 s of filter time
+    static const int CYCLES = 2000;
+
+    static void SetUpTestSuite() {
+        rclcpp::init(0, nullptr);
+    }
+
+    static void TearDownTestSuite() {
+        rclcpp::shutdown();
+    }
+
+    static FilterParameters parameters(double output_rate) {
+        FilterParameters parameters;
+        parameters.enableImu = true;
+        parameters.enableWheel = true;
+        parameters.enableLidar = true;
+        parameters.filterFreq = "l";
+        parameters.healthRate = 10.0;
+        parameters.outputRate = output_rate;
+        return parameters;
+    }
+
+    //----------
+    // inputs: standing still at the origin
+    //----------
+    static ImuMeasurement imu(double stamp) {
+        ImuMeasurement m = {};
+        m.stamp = stamp;
+        m.orientation[3] = 1;
+        m.linearAcceleration[2] = 9.81;
+        for (int i = 0; i < 3; i++){
+            m.orientationCovariance[4*i] = 1e-4;
+            m.angularVelocityCovariance[4*i] = 1e-4;
+            m.linearAccelerationCovariance[4*i] = 2.5e-3;
+        }
+        return m;
+    }
+
+    static OdometryMeasurement wheel(double stamp) {
+        OdometryMeasurement m = {};
+        m.stamp = stamp;
+        m.orientation[3] = 1;
+        m.twistCovariance[0] = 4e-4;
+        m.twistCovariance[35] = 4e-4;
+        return m;
+    }
+
+    static OdometryMeasurement lidar(double stamp) {
+        OdometryMeasurement m = {};
+        m.stamp = stamp;
+        m.orientation[3] = 1;
+        // feature counts of the adaptive covariance
+        m.linear[0] = 400;
+        m.angular[0] = 4000;
+        return m;
+    }
+
+    //----------
+    // driving
+    //----------
+    // waits until the strand ran everything posted so far
+    static void drain(AdaptiveFilter &filter) {
+        if (!filter.strand){
+            return;
+        }
+        std::atomic<bool> done(false);
+        filter.dispatch([&done] { done = true; });
+        while (!done){
+            std::this_thread::yield();
+        }
+    }
+
+    // one 5 ms cycle: 4 IMU samples, a wheel message every 4th cycle and a
+    // LiDAR one every 10th, then the step
+    static void cycle(AdaptiveFilter &filter, int i) {
+        double t = filter.get_clock()->now().seconds();
+        for (int k = 0; k < 4; k++){
+            filter.deliver(adaptive_filter::TRACE_IMU, &AdaptiveFilter::imuHandler, imu(t));
+        }
+        if (i % 4 == 0){
+            filter.deliver(adaptive_filter::TRACE_WHEEL, &AdaptiveFilter::wheelOdometryHandler, wheel(t));
+        }
+        if (i % 10 == 0){
+            filter.deliver(adaptive_filter::TRACE_LIDAR, &AdaptiveFilter::laserOdometryHandler, lidar(t));
+        }
+        filter.step_event();
+        drain(filter);
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+
+    static void allocations(uint64_t *out) {
+        AllocCounters counters;
+        adaptive_filter::alloc_counters(counters);
+        std::copy(counters.allocs, counters.allocs + adaptive_filter::N_ALLOC_TAGS, out);
+    }
+
+    static void expect_steady_state_without_allocations(AdaptiveFilter &filter, const std::string &ns) {
+        ASSERT_TRUE(adaptive_filter::alloc_tracking());
+
+        // a subscriber, so that the publisher thread fills in and publishes
+        std::atomic<uint64_t> outputs(0);
+        auto listener = std::make_shared<rclcpp::Node>("allocation_test_listener");
+        auto subscription = listener->create_subscription<nav_msgs::msg::Odometry>(ns + "/ekf_loam/filter_odom_to_init", 5,
+            [&outputs](nav_msgs::msg::Odometry::ConstSharedPtr) { outputs++; });
+        rclcpp::executors::SingleThreadedExecutor executor;
+        executor.add_node(listener);
+        std::thread spinner([&executor] { executor.spin(); });
+
+        filter.configure();
+        filter.activate();
+        drain(filter);
+        for (int i = 0; i < WARMUP; i++){
+            cycle(filter, i);
+        }
+        EXPECT_TRUE(filter.imuActivated && filter.wheelActivated && filter.lidarActivated);
+        EXPECT_TRUE(AdaptiveFilter::has_subscribers(filter.pubFilteredOdometry));
+
+        uint64_t received = outputs;
+        uint64_t before[adaptive_filter::N_ALLOC_TAGS], after[adaptive_filter::N_ALLOC_TAGS];
+        allocations(before);
+        for (int i = WARMUP; i < WARMUP + CYCLES; i++){
+            cycle(filter, i);
+        }
+        allocations(after);
+        EXPECT_GT(outputs - received, 0u) << "no output was published";
+
+        for (int tag = adaptive_filter::ALLOC_STEP; tag <= adaptive_filter::ALLOC_OUTPUTS; tag++){
+            EXPECT_EQ(after[tag] - before[tag], 0u) << adaptive_filter::alloc_tag_name(tag) << " allocated in steady state";
+        }
+
+        filter.deactivate();
+        drain(filter);
+        executor.cancel();
+        spinner.join();
+    }
+};
+
+TEST_F(AdaptiveFilterTest, InlineSteadyStateDoesNotAllocate) {
+    // outputs on the LiDAR corrections
+    auto filter = std::make_shared<AdaptiveFilter>("allocation_test_inline", parameters(0.0), "/inline");
+    expect_steady_state_without_allocations(*filter, "/inline");
+}
+
+TEST_F(AdaptiveFilterTest, PoolSteadyStateDoesNotAllocate) {
+    // declared first, so that it outlives the filter's strand
+    WorkStealingPool pool(2);
+    // outputs at 100 Hz, extrapolated by the publisher thread
+    auto filter = std::make_shared<AdaptiveFilter>("allocation_test_pool", parameters(100.0), "/pool", pool.make_strand());
+    expect_steady_state_without_allocations(*filter, "/pool");
+}
@@ -0,0 +1,72 @@
+// Accuracy of ClockSync on a simulated sensor: a clock with an offset and a
+// 50 ppm drift, sampled at 100 Hz, whose messages arrive after a minimum
+// transport delay plus an exponential jitter. Once the first windows are in,
+// the corrected stamps must stay within 0.2 ms of the earliest possible
+// arrival times (true time plus the minimum delay).
+#include <gtest/gtest.h>
+
+#include <adaptive_filter/ClockSync.h>
+
+#include <cmath>
+#include <random>
+
+using adaptive_filter::ClockSync;
+
+namespace {
+
+const double RATE = 100.0;          // [Hz]
+const double MIN_DELAY = 0.5e-3;    // [s]
+const double JITTER = 1e-3;         // [s] mean of the exponential part
+const double TOLERANCE = 0.2e-3;    // [s]
+
+struct SimulatedSensor {
+    double offset;   // sensor clock at true time 0 [s]
+    double drift;    // [s/s]
+    std::mt19937 random;
+    std::exponential_distribution<double> jitter;
+
+    SimulatedSensor(double offset, double drift, unsigned seed)
+        : offset(offset), drift(drift), random(seed), jitter(1.0/JITTER) {}
+
+    double stamp(double t) const { return offset + (1.0 + drift)*t; }
+    double arrival(double t) { return t + MIN_DELAY + jitter(random); }
+};
+
+// largest error of the corrected stamps between t_check and t_end [s]
+double max_error(SimulatedSensor &sensor, double t_check, double t_end) {
+    ClockSync clock;
+    double worst = 0;
+    for (int k = 0; k/RATE < t_end; k++){
+        double t = k/RATE;
+        double stamp = sensor.stamp(t);
+        clock.sample(stamp, sensor.arrival(t));
+        if (t >= t_check){
+            worst = std::max(worst, std::abs(clock.to_host(stamp) - (t + MIN_DELAY)));
+        }
+    }
+    return worst;
+}
+
+}  // namespace
+
+TEST(ClockSyncTest, TracksOffsetAndDriftWithin200us) {
+    SimulatedSensor sensor(-1234.5, 50e-6, 1);
+    EXPECT_LT(max_error(sensor, 10.0, 300.0), TOLERANCE);
+}
+
+TEST(ClockSyncTest, TracksNegativeDriftWithin200us) {
+    SimulatedSensor sensor(42.0, -50e-6, 2);
+    EXPECT_LT(max_error(sensor, 10.0, 300.0), TOLERANCE);
+}
+
+TEST(ClockSyncTest, EstimatesTheDrift) {
+    SimulatedSensor sensor(0.0, 50e-6, 3);
+    ClockSync clock;
+    for (int k = 0; k < 300*RATE; k++){
+        double t = k/RATE;
+        clock.sample(sensor.stamp(t), sensor.arrival(t));
+    }
+    ASSERT_TRUE(clock.synchronized());
+    // host time runs 1/(1 + drift) as fast as the sensor clock
+    EXPECT_NEAR(clock.drift(), 1.0/(1.0 + 50e-6) - 1.0, 5e-6);
+}
@@ -0,0 +1,144 @@
+// Metrics registry and server: counters, a gauge and a histogram updated
+// from several threads (more than MAX_SHARDS, over several registries), then
+// scraped over a "unix:" endpoint; the exposition text must carry the exact
+// totals.
+#include <gtest/gtest.h>
+
+#include <adaptive_filter/Metrics.h>
+
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using adaptive_filter::MetricsRegistry;
+using adaptive_filter::MetricsServer;
+
+namespace {
+
+const int THREADS = MetricsRegistry::MAX_SHARDS + 4;
+const int UPDATES = 10000;
+
+// whole HTTP response of one request to a Unix socket, empty on failure
+std::string scrape(const std::string &path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0){
+        return "";
+    }
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0){
+        close(fd);
+        return "";
+    }
+
+    const std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())){
+        close(fd);
+        return "";
+    }
+
+    std::string response;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0){
+        response.append(buffer, n);
+    }
+    close(fd);
+    return response;
+}
+
+bool has_line(const std::string &text, const std::string &line) {
+    return text.find("\n" + line + "\n") != std::string::npos;
+}
+
+}  // namespace
+
+TEST(MetricsTest, ScrapesTotalsOfConcurrentUpdates) {
+    MetricsRegistry metrics;
+    int steps = metrics.counter("test_steps_total", "Steps.");
+    int imu = metrics.counter("test_measurements_total", "Measurements.", "sensor=\"imu\"");
+    int lidar = metrics.counter("test_measurements_total", "Measurements.", "sensor=\"lidar\"");
+    int load = metrics.gauge("test_load", "Load.");
+    int time = metrics.histogram("test_step_seconds", "Step time.", "", {0.001, 0.005});
+    ASSERT_GE(steps, 0);
+    ASSERT_GE(time, 0);
+
+    // other registries updated by the same threads must not disturb it
+    std::vector<std::unique_ptr<MetricsRegistry>> others;
+    std::vector<int> otherCounters;
+    for (int r = 0; r < 6; r++){
+        others.emplace_back(new MetricsRegistry());
+        otherCounters.push_back(others.back()->counter("other_total", "Other."));
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++){
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < UPDATES; i++){
+                metrics.add(steps);
+                metrics.add(t % 2 == 0 ? imu : lidar, 2);
+                // 0.5 ms, 2 ms and 10 ms in turn
+                metrics.observe(time, i % 3 == 0 ? 0.0005 : i % 3 == 1 ? 0.002 : 0.01);
+                for (size_t r = 0; r < others.size(); r++){
+                    others[r]->add(otherCounters[r]);
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads){
+        thread.join();
+    }
+    metrics.set(load, 0.25);
+
+    const std::string path = "/tmp/adaptive_filter_test_metrics_" + std::to_string(getpid()) + ".sock";
+    MetricsServer server;
+    ASSERT_TRUE(server.start(metrics, "unix:" + path));
+    std::string response = scrape(path);
+    server.stop();
+
+    ASSERT_EQ(response.compare(0, 15, "HTTP/1.0 200 OK"), 0) << response;
+    EXPECT_NE(response.find("Content-Type: text/plain; version=0.0.4\r\n"), std::string::npos);
+    size_t body = response.find("\r\n\r\n");
+    ASSERT_NE(body, std::string::npos);
+    std::string text = response.substr(body + 3);
+
+    const long total = static_cast<long>(THREADS)*UPDATES;
+    const long even = static_cast<long>((THREADS + 1)/2)*UPDATES;
+    const long fast = static_cast<long>(THREADS)*((UPDATES + 2)/3);
+    const long middle = static_cast<long>(THREADS)*((UPDATES + 1)/3);
+
+    EXPECT_TRUE(has_line(text, "# HELP test_steps_total Steps.")) << text;
+    EXPECT_TRUE(has_line(text, "# TYPE test_steps_total counter")) << text;
+    EXPECT_TRUE(has_line(text, "test_steps_total " + std::to_string(total))) << text;
+
+    // one HELP/TYPE pair for the family
+    EXPECT_EQ(text.find("# TYPE test_measurements_total"), text.rfind("# TYPE test_measurements_total"));
+    EXPECT_TRUE(has_line(text, "test_measurements_total{sensor=\"imu\"} " + std::to_string(2*even))) << text;
+    EXPECT_TRUE(has_line(text, "test_measurements_total{sensor=\"lidar\"} " + std::to_string(2*(total - even)))) << text;
+
+    EXPECT_TRUE(has_line(text, "# TYPE test_load gauge")) << text;
+    EXPECT_TRUE(has_line(text, "test_load 0.25")) << text;
+
+    EXPECT_TRUE(has_line(text, "# TYPE test_step_seconds histogram")) << text;
+    EXPECT_TRUE(has_line(text, "test_step_seconds_bucket{le=\"0.001\"} " + std::to_string(fast))) << text;
+    EXPECT_TRUE(has_line(text, "test_step_seconds_bucket{le=\"0.005\"} " + std::to_string(fast + middle))) << text;
+    EXPECT_TRUE(has_line(text, "test_step_seconds_bucket{le=\"+Inf\"} " + std::to_string(total))) << text;
+    EXPECT_TRUE(has_line(text, "test_step_seconds_count " + std::to_string(total))) << text;
+
+    for (size_t r = 0; r < others.size(); r++){
+        EXPECT_TRUE(has_line("\n" + others[r]->render(), "other_total " + std::to_string(total)));
+    }
+}
+
+TEST(MetricsTest, RejectsMalformedEndpoints) {
+    MetricsRegistry metrics;
+    MetricsServer server;
+    EXPECT_FALSE(server.start(metrics, "unix:"));
+    EXPECT_FALSE(server.start(metrics, "localhost"));
+    EXPECT_FALSE(server.start(metrics, "127.0.0.1:0"));
+    EXPECT_FALSE(server.is_running());
+}